@@ -1,24 +1,28 @@
 #ifndef BOARD_H
 #define BOARD_H
 
-#define MAX_MOVES 20
 #define MAX_LEVELS 20
 #define MAX_FILENAME 256
-#define MAX_GHOSTS 25
+#define MAX_GHOSTS 128
+#define MAX_SIDE 10000 // widest and tallest level DIM accepts
+#define BOARD_PAGE_CELLS 64 // cells per checkpoint page
+#define CELL_LOCK_STRIPES 64 // cell i is guarded by lock i % CELL_LOCK_STRIPES
 
 #include <pthread.h>
+#include <stddef.h>
+#include "lockprof.h" // CELL_LOCK, STATE_WRLOCK...
 
 typedef enum {
     REACHED_PORTAL = 1,
     VALID_MOVE = 0,
     INVALID_MOVE = -1,
     DEAD_PACMAN = -2,
+    RESTORED_PACMAN = 2, // died and was brought back from a checkpoint
 } move_t;
 
 typedef struct {
     char command;
-    int turns;
-    int turns_left;
+    int turns; // ticks a 'T' waits, 0 for a 'T' sent by the client (this tick only)
 } command_t;
 
 typedef struct {
@@ -26,27 +30,28 @@ typedef struct {
     int alive; // if is alive
     int points; // how many points have been collected
     int passo; // number of plays to wait before starting
-    command_t moves[MAX_MOVES];
+    command_t *moves; // n_moves, read only once loaded
     int current_move;
     int n_moves;
+    int turns_left; // of the current 'T' move, 0 until it starts
     int waiting;
 } pacman_t;
 
 typedef struct {
     int pos_x, pos_y; //current position
     int passo; // number of plays to wait before starting
-    command_t moves[MAX_MOVES];
+    command_t *moves; // n_moves, read only once loaded
     int n_moves;
     int current_move;
+    int turns_left; // of the current 'T' move, 0 until it starts
     int waiting;
     int charged;
 } ghost_t;
 
 typedef struct {
     char content; // stuff like 'P' for pacman 'M' for monster and 'W' for wall
-    int has_dot; // whether there is a dot in this position or not
-    int has_portal; // whether there is a portal in this position or not
-    pthread_mutex_t lock;
+    unsigned char has_dot; // whether there is a dot in this position or not
+    unsigned char has_portal; // whether there is a portal in this position or not
 } board_pos_t;
 
 typedef struct {
@@ -56,11 +61,15 @@ typedef struct {
     pacman_t* pacmans; // array containing every pacman in the board to iterate through when processing
     int n_ghosts; //number of ghosts in the board
     ghost_t* ghosts; // array containing every ghost in the board to iterate through when processing
-    char level_name[256]; //name for the level file to keep track of which will be the next
-    char pacman_file[256]; // file with pacman movements
-    char ghosts_files[MAX_GHOSTS][256]; // files with monster movements
+    char *level_name; //name for the level file to keep track of which will be the next
     int tempo; // Duracao de cada jogada???
+    int session_slot; // leaderboard slot of the session playing this board
+    unsigned int rng_state; // rand_r state of the 'R' moves, seeded per level
+    int n_pages;
+    unsigned char *dirty_pages; // pages with cells changed since the last checkpoint
+    size_t bytes; // heap owned by the board, see board_bytes
     pthread_rwlock_t state_lock;
+    pthread_mutex_t cell_locks[CELL_LOCK_STRIPES];
 } board_t;
 
 /*Move pacman/monster in a certain direction on the board must check for boundaries, walls and other monsters
@@ -70,6 +79,23 @@ Maybe do 1 function for each direction
 int move_pacman(board_t* board, int pacman_index, command_t* command);
 int move_ghost(board_t* board, int ghost_index, command_t* command);
 
+/*A charged ghost slides in direction until a wall or another ghost stops it, or it
+reaches the pacman*/
+int move_ghost_charged(board_t* board, int ghost_index, char direction);
+
+/*Kills the pacman at (new_x, new_y), if there is one. Returns DEAD_PACMAN or VALID_MOVE*/
+int find_and_kill_pacman(board_t* board, int new_x, int new_y);
+
+struct board_snapshot;
+
+/*One pacman tick: the command from the client, or the next move of its file if command
+is '\0'. Handles 'G' (checkpoint) and restores a dead pacman if checkpoint has one.
+Returns RESTORED_PACMAN in that case. Sessions and the replay driver both step through here*/
+int play_pacman(board_t* board, int pacman_index, char command, struct board_snapshot* checkpoint);
+
+/*One ghost tick, the next move of its file*/
+int play_ghost(board_t* board, int ghost_index);
+
 /*Remove an object (Pacman)*/
 void kill_pacman(board_t* board, int pacman_index);
 
@@ -87,14 +113,10 @@ int load_level(board_t* board, char* filename, char* dirname, int accumulated_po
 // Unloads levels loaded by load_level
 void unload_level(board_t * board);
 
-// DEBUG FILE
-
-void open_debug_file(char *filename);
-
-void close_debug_file();
-
-void debug(const char * format, ...);
+/*Bytes of the board struct and everything it owns: cells, entities, moves, pages*/
+size_t board_bytes(board_t *board);
 
+/*Logs the level and its cells (log_debug)*/
 void print_board(board_t* board);
 
 void sleep_ms(int milliseconds);
@@ -0,0 +1,80 @@
+#ifndef FIFO_IO_H
+#define FIFO_IO_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*I/O on the client FIFOs. The blocking backend is the original path: the pacman thread
+write()s its frames and every session has a listener thread read()ing its request FIFO.
+The io_uring backend has one service thread own a ring: while sessions play it wakes
+every couple of timer wheel slots and hands the kernel every frame queued meanwhile by the
+pacman threads in one io_uring_enter, which also sleeps until the next batch. Every
+request FIFO keeps a read armed in the ring, so sessions need no listener thread.
+io_uring falls back to blocking if the kernel refuses the ring (older than 5.11,
+io_uring_disabled, seccomp). Every syscall either backend makes for the FIFOs is counted
+in METRIC_FIFO_SYSCALLS*/
+
+typedef enum {
+    FIFO_IO_BLOCKING = 0,
+    FIFO_IO_URING,
+} fifo_io_mode_t;
+
+#define FIFO_READ_BUFFER 64
+
+typedef struct fifo_op {
+    struct fifo_op *next; // list of ops waiting for the ring thread
+    int kind;
+} fifo_op_t;
+
+/*The frame writes of one client, at most one in flight. Zeroed before the first use*/
+typedef struct {
+    fifo_op_t op;
+    int fd;
+    const unsigned char *buf;
+    size_t len; // left to write
+    atomic_uint busy; // 0 idle, 1 in flight, 2 in flight and the owner waits
+} fifo_send_t;
+
+/*Gets every chunk read from a request FIFO, on the ring thread. n <= 0 (end of file or
+error) is the last call*/
+typedef void (*fifo_data_fn)(void *arg, const unsigned char *data, ssize_t n);
+
+/*A read kept armed on a request FIFO. Zeroed before the first use*/
+typedef struct {
+    fifo_op_t op, cancel;
+    int fd;
+    fifo_data_fn on_data;
+    void *arg;
+    atomic_uint armed; // 0 disarmed, 1 armed, 2 armed and the owner waits for the disarm
+    atomic_int stopping;
+    int finished; // completions of the read and the cancel seen while stopping (ring thread)
+    unsigned char buf[FIFO_READ_BUFFER];
+} fifo_reader_t;
+
+/*Starts the backend, before the sessions. Returns the mode in use*/
+fifo_io_mode_t fifo_io_init(fifo_io_mode_t mode);
+fifo_io_mode_t fifo_io_mode();
+
+/*Writes a frame to fd and returns once it is written, with either backend*/
+void fifo_write(int fd, const void *buf, size_t len);
+
+/*Writes a frame to fd. With io_uring only queues it: buf must stay valid and s unused
+until fifo_send_wait*/
+void fifo_send(fifo_send_t *s, int fd, const void *buf, size_t len);
+
+/*Waits for the frame s has in flight, if any*/
+void fifo_send_wait(fifo_send_t *s);
+
+/*Arms a read on fd (switched to O_NONBLOCK, the ring polls it) that stays armed until
+fifo_reader_stop or the end of file. Returns -1 with the blocking backend: the caller
+reads with fifo_read on a thread of its own*/
+int fifo_reader_start(fifo_reader_t *r, int fd, fifo_data_fn on_data, void *arg);
+
+/*Disarms the read. on_data is not running and won't be called again once it returns*/
+void fifo_reader_stop(fifo_reader_t *r);
+
+/*read() for the blocking backend, counted*/
+ssize_t fifo_read(int fd, void *buf, size_t len);
+
+#endif
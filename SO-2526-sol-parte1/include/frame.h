@@ -0,0 +1,56 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "board.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*Published frames. At the end of every tick the pacman thread encodes its board into
+the back buffer of its slot and flips it to the front, so the state lock is only held
+for the copy: the write to the client, stats and spectators use the published frame
+without touching the live board. Each buffer is a seqlock, readers retry only if the
+writer went around both buffers while they were copying*/
+
+#define FRAME_METADATA 6 // int32: width, height, tempo, victory, game_over, points
+#define FRAME_HEADER (1 + FRAME_METADATA * sizeof(int32_t))
+/*OP_CODE_BOARD_VIEW frames: width and height are the window's, then int32: offset_x,
+offset_y (of the window on the board), board_width, board_height*/
+#define FRAME_VIEW_METADATA 4
+#define FRAME_VIEW_HEADER (FRAME_HEADER + FRAME_VIEW_METADATA * sizeof(int32_t))
+
+/*The map a client can show, in cells. A board that fits is sent whole as OP_CODE_BOARD;
+a bigger one is cut to a window around the pacman. 0 means unlimited*/
+typedef struct {
+    int cols, rows;
+} frame_view_t;
+
+/*Allocates the buffers of every session slot. Until then publishing fails*/
+int frame_init(int max_slots);
+
+/*Encodes the board as seen through view (NULL: the whole board) into packet, which must
+hold frame_size bytes. Returns the message length*/
+size_t frame_encode(board_t *board, int victory, int game_over, const frame_view_t *view, unsigned char *packet);
+
+/*Size of the message frame_encode writes for board and view*/
+size_t frame_size(board_t *board, const frame_view_t *view);
+
+/*Encodes the board (state lock held) and makes it the current frame of slot. Only the
+pacman thread of the session publishes. Returns -1 if there is no buffer for the frame*/
+int frame_publish(int slot, board_t *board, int victory, int game_over, const frame_view_t *view);
+
+/*The current frame of slot, for its publisher: stable until it publishes again*/
+const unsigned char *frame_current(int slot, size_t *len);
+
+/*Copies at most cap bytes of the current frame of slot into out. Returns the frame
+length (0 if the slot has none), lock free*/
+size_t frame_read(int slot, unsigned char *out, size_t cap);
+
+/*The session of slot ended, readers see no frame until the next one publishes*/
+void frame_clear(int slot);
+
+/*Readers that follow the frames of slot besides its own client (spectators) register
+with delta 1 and leave with -1. Overload control only coalesces unwatched sessions*/
+void frame_watch(int slot, int delta);
+int frame_watchers(int slot);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*Sleeps while *word == expected, until the CLOCK_MONOTONIC deadline in ns (0 = none).
+Returns 0 when woken, -1 with errno EAGAIN (value changed), EINTR or ETIMEDOUT*/
+int futex_wait(atomic_uint *word, unsigned expected, uint64_t deadline_ns);
+
+/*Wakes up to n threads sleeping on word*/
+void futex_wake(atomic_uint *word, int n);
+
+uint64_t monotonic_ns();
+
+#endif
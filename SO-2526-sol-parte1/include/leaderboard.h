@@ -0,0 +1,39 @@
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#define LEADERBOARD_K 5 // how many sessions are ranked
+#define LEADERBOARD_NAME 32
+
+#include <stddef.h>
+
+typedef struct {
+    int slot_id;
+    int points;
+    int pos_x, pos_y; // pacman position
+    int width, height; // current level dimensions
+    size_t bytes; // memory the session uses for the level
+    char level_name[LEADERBOARD_NAME];
+} leaderboard_entry_t;
+
+/*Allocates one record per session slot. Until this is called every update is a no-op,
+so engine code can run without a server*/
+int leaderboard_init(int max_slots);
+
+/*Marks the slot active and records the level it is playing*/
+void leaderboard_set_level(int slot, const char *level_name, int width, int height, size_t bytes);
+
+/*Records the pacman state of a slot. A change of points moves the slot in the top-K,
+or in the heap of the sessions outside it (O(log n) under one lock). The top-K readers
+only see the ranking change*/
+void leaderboard_update(int slot, int points, int pos_x, int pos_y);
+
+/*Session ended. If it was in the top-K the best session outside takes its place*/
+void leaderboard_remove(int slot);
+
+/*Copies at most k (<= LEADERBOARD_K) best sessions into out, best first. O(K), lock free*/
+int leaderboard_top(leaderboard_entry_t *out, int k);
+
+/*Number of active sessions*/
+int leaderboard_active();
+
+#endif
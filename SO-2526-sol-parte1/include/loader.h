@@ -0,0 +1,34 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "board.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define LOADER_THREADS 2 // default size of the loader pool
+#define LOADER_QUEUE 64 // pending preloads, submissions past this load on the caller
+
+/*A level being built in the background. The session submits the next level as soon as
+the current one starts, so when the pacman reaches the portal the new board is already
+parsed and the transition is a pointer swap*/
+typedef struct {
+    char filename[MAX_FILENAME];
+    char dirname[MAX_FILENAME];
+    board_t *board; // NULL if the level failed to load
+    uint64_t load_ns; // time spent in load_level
+    atomic_uint done; // futex word, 1 once board is final
+} level_job_t;
+
+/*Starts the loader threads. Without them every submission loads on the caller*/
+int loader_start(int n_threads);
+
+/*Queues load_level(filename, dirname) with 0 points. Returns NULL if out of memory*/
+level_job_t *loader_submit(const char *dirname, const char *filename);
+
+/*Waits for the job and frees it. The caller owns the returned board (unload_level + free)*/
+board_t *loader_wait(level_job_t *job);
+
+/*Waits for the job and throws the board away*/
+void loader_discard(level_job_t *job);
+
+#endif
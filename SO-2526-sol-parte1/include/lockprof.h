@@ -0,0 +1,74 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+
+/*Lock contention profiler for the board locks (make LOCKPROF=1, after a make clean).
+Every acquisition site keeps its own counters: acquisitions, how many found the lock
+taken, a histogram of the wait and the time the lock was then held. Without LOCKPROF
+the macros are the plain pthread calls*/
+
+typedef enum {
+    LOCK_STATE_READ = 0, // board->state_lock taken for reading
+    LOCK_STATE_WRITE,
+    LOCK_CELL, // board->cell_locks[i % CELL_LOCK_STRIPES], the stripe of cell i
+    LOCK_CLASSES,
+} lock_class_t;
+
+#ifdef LOCKPROF
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define LOCKPROF_BUCKETS 24 // wait histogram, bucket b counts waits below 2^(b + 6) ns
+#define LOCKPROF_MAX_HELD 64 // locks a thread holds at once with their hold time measured
+
+typedef struct lockprof_site {
+    lock_class_t cls;
+    const char *file;
+    int line;
+    const char *func;
+    atomic_int registered;
+    struct lockprof_site *next;
+    _Atomic uint64_t acquired;
+    _Atomic uint64_t contended; // the lock was taken when the site asked for it
+    _Atomic uint64_t wait_ns, wait_max_ns;
+    _Atomic uint64_t hold_ns, hold_max_ns;
+    _Atomic uint64_t wait_hist[LOCKPROF_BUCKETS];
+} lockprof_site_t;
+
+void lockprof_mutex_lock(pthread_mutex_t *lock, lockprof_site_t *site, const char *func);
+void lockprof_mutex_unlock(pthread_mutex_t *lock);
+void lockprof_rdlock(pthread_rwlock_t *lock, lockprof_site_t *site, const char *func);
+void lockprof_wrlock(pthread_rwlock_t *lock, lockprof_site_t *site, const char *func);
+void lockprof_rwunlock(pthread_rwlock_t *lock);
+
+/*Logs the counters of every site and class (log_info), cumulative since the start.
+The server logs them on SIGUSR1, with the active games*/
+void lockprof_report();
+
+// One static site per expansion, so every call site is counted apart
+#define LOCKPROF_AT(cls_, fn, lock) do { \
+    static lockprof_site_t lockprof_site_ = { .cls = (cls_), .file = __FILE__, .line = __LINE__ }; \
+    fn((lock), &lockprof_site_, __func__); \
+} while (0)
+
+#define CELL_LOCK(lock) LOCKPROF_AT(LOCK_CELL, lockprof_mutex_lock, lock)
+#define CELL_UNLOCK(lock) lockprof_mutex_unlock(lock)
+#define STATE_RDLOCK(lock) LOCKPROF_AT(LOCK_STATE_READ, lockprof_rdlock, lock)
+#define STATE_WRLOCK(lock) LOCKPROF_AT(LOCK_STATE_WRITE, lockprof_wrlock, lock)
+#define STATE_UNLOCK(lock) lockprof_rwunlock(lock)
+
+#else
+
+#define CELL_LOCK(lock) pthread_mutex_lock(lock)
+#define CELL_UNLOCK(lock) pthread_mutex_unlock(lock)
+#define STATE_RDLOCK(lock) pthread_rwlock_rdlock(lock)
+#define STATE_WRLOCK(lock) pthread_rwlock_wrlock(lock)
+#define STATE_UNLOCK(lock) pthread_rwlock_unlock(lock)
+
+static inline void lockprof_report() {}
+
+#endif
+
+#endif
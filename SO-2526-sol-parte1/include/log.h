@@ -0,0 +1,49 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*Asynchronous logging. Every thread formats its lines into its own ring (one producer,
+the writer thread is the only consumer), so logging never takes a lock or makes a
+syscall on the calling thread. The writer drains the rings into the sink each line was
+addressed to: the main sink or the one a session chose for its threads.
+
+Calls below LOG_LEVEL are compiled out (make LOG_LEVEL=n, after a make clean)*/
+
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_RING_SIZE (32 * 1024) // bytes per thread, lines are dropped when it is full
+#define LOG_MAX_LINE 4096 // longer lines are truncated
+#define LOG_MAX_SINKS 256
+#define LOG_MAIN_SINK 0
+#define LOG_FLUSH_MS 10 // the writer drains at least this often
+
+/*Opens the main sink and starts the writer. Until then every call is a no-op*/
+int log_init(const char *main_path);
+
+/*Sink writing to path, the same id if it is already open. Returns -1 on error*/
+int log_open_sink(const char *path);
+
+/*Lines of the calling thread go to sink from now on (LOG_MAIN_SINK by default)*/
+void log_set_sink(int sink);
+int log_get_sink();
+
+/*Returns once every line logged before the call is written*/
+void log_flush();
+
+void log_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// Disabled levels still type check their arguments but generate no code
+#define LOG_AT(level, ...) do { if ((level) <= LOG_LEVEL) log_write((level), __VA_ARGS__); } while (0)
+
+#define log_error(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) LOG_AT(LOG_DEBUG, __VA_ARGS__)
+
+#endif
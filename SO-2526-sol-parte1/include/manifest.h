@@ -0,0 +1,41 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "board.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*A playable level as found in the levels directory, so sessions never list the
+directory themselves. Only its header is kept: the loader parses the level again when it
+is played, deps just tells which file changes concern it*/
+typedef struct {
+    char filename[MAX_FILENAME]; // name of the .lvl inside the directory
+    long size; // bytes of the .lvl file
+    int width, height, tempo;
+    int n_ghosts;
+    char *deps; // names of its pacman and ghost files, each NUL terminated
+    size_t deps_len; // bytes of deps
+} level_info_t;
+
+/*Immutable, reference counted snapshot of the levels sorted in natural order
+("2.lvl" before "10.lvl"). Refreshing publishes a new snapshot, sessions keep
+playing the one they acquired*/
+typedef struct {
+    atomic_int refs;
+    uint64_t version; // bumped on every refresh
+    char dir[MAX_FILENAME];
+    int n_levels;
+    level_info_t levels[];
+} level_manifest_t;
+
+/*Scans dir and starts the thread that follows it with inotify*/
+int manifest_init(const char *dir);
+
+/*Scans dir once, without following it (tools)*/
+int manifest_load(const char *dir);
+
+/*Current snapshot, must be given back with manifest_release*/
+level_manifest_t *manifest_acquire();
+void manifest_release(level_manifest_t *manifest);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    METRIC_TICKS = 0, // pacman (session) ticks
+    METRIC_GHOST_TICKS,
+    METRIC_FRAMES_SENT,
+    METRIC_BYTES_SENT,
+    METRIC_LEVELS_LOADED,
+    METRIC_TICK_OVERRUNS, // entity ticks that started after their deadline
+    METRIC_VIRTUAL_JUMPS, // virtual clock advances to the next deadline
+    METRIC_LOG_DROPPED, // log lines lost because the thread's ring was full
+    METRIC_FIFO_SYSCALLS, // syscalls made for client FIFO I/O (see fifo_io.h)
+    METRIC_OVERLOAD_RAISED, // overload level steps up (see overload.h)
+    METRIC_OVERLOAD_LOWERED,
+    METRIC_FRAMES_SHED, // frames not sent to lower the frame rate
+    METRIC_GHOST_WAKEUPS_SAVED, // ghost moves made in a wakeup of an earlier one
+    METRIC_ADMISSION_PAUSED_MS, // time main did not admit new clients
+    METRIC_COUNTERS,
+} metric_counter_t;
+
+typedef enum {
+    HIST_TICK_DURATION = 0, // work done in a pacman tick (move + frame)
+    HIST_STATE_LOCK_WAIT, // time waiting for board->state_lock
+    HIST_LEVEL_LOAD, // load_level
+    HIST_LEVEL_SWITCH, // portal reached -> first frame of the next level sent
+    HIST_CHECKPOINT, // snapshot_take
+    HIST_RESTORE, // snapshot_restore
+    HIST_HISTOGRAMS,
+} metric_hist_t;
+
+/*Histograms are log-linear (HDR style): HIST_SUB_BUCKETS per power of two of
+nanoseconds, up to 2^HIST_MAX_EXP ns (~4.5 min)*/
+#define HIST_SUB_BITS 2
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 38
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + HIST_SUB_BUCKETS)
+
+typedef double (*metrics_gauge_fn)(void);
+
+/*Counters and histograms are kept per thread on their own cache lines and only
+summed when the metrics are read, so recording never contends*/
+void metrics_inc(metric_counter_t counter, uint64_t value);
+void metrics_observe_ns(metric_hist_t hist, uint64_t ns);
+
+uint64_t metrics_now_ns();
+
+/*Gauges are sampled through a callback when the metrics are read*/
+void metrics_register_gauge(const char *name, const char *help, metrics_gauge_fn fn);
+
+/*Aggregated values*/
+uint64_t metrics_counter(metric_counter_t counter);
+
+/*Prometheus name of a counter*/
+const char *metrics_counter_name(metric_counter_t counter);
+double metrics_quantile_ns(metric_hist_t hist, double q);
+
+/*Writes every metric in the Prometheus text exposition format*/
+void metrics_write_prometheus(FILE *f);
+
+/*Serves metrics_write_prometheus on a Unix socket (plain text, or an HTTP response
+if the scraper sends a GET request)*/
+int metrics_start_exporter(const char *socket_path);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#include <stdint.h>
+
+/*Overload control. When the box is saturated every tick starts late and all sessions
+lag alike. A controller thread samples the share of late ticks (METRIC_TICK_OVERRUNS
+over the pacman and ghost ticks) and the admission queue every OVERLOAD_SAMPLE_MS and
+sheds load in steps, each keeping the ones before it:
+  1. pacman threads send a frame every OVERLOAD_FRAME_STRIDE ticks only
+  2. ghosts of sessions nobody else watches (frame_watchers) move OVERLOAD_GHOST_BATCH
+     times per wakeup, sleeping as many periods: same moves, fewer wakeups and locks
+  3. main stops reading the register FIFO, new clients wait there
+It steps up while ticks run late, or the queue holds requests and ticks are not all on
+time, and down once ticks were on time for OVERLOAD_COOL_SAMPLES samples in a row*/
+
+#define OVERLOAD_SAMPLE_MS 250
+#define OVERLOAD_HIGH_PERMILLE 50 // late ticks per 1000 that step up
+#define OVERLOAD_LOW_PERMILLE 10 // below this a sample counts as cool
+#define OVERLOAD_MIN_TICKS 20 // fewer ticks in a sample say nothing about the load
+#define OVERLOAD_COOL_SAMPLES 4
+#define OVERLOAD_FRAME_STRIDE 2
+#define OVERLOAD_GHOST_BATCH 2
+
+typedef enum {
+    OVERLOAD_NONE = 0,
+    OVERLOAD_SHED_FRAMES,
+    OVERLOAD_COALESCE_GHOSTS,
+    OVERLOAD_PAUSE_ADMISSION,
+    OVERLOAD_LEVELS,
+} overload_level_t;
+
+typedef double (*overload_queue_fn)(void);
+
+/*Starts the controller. queue_depth returns the requests waiting for a worker.
+With enabled == 0 the level stays OVERLOAD_NONE*/
+int overload_start(int enabled, overload_queue_fn queue_depth);
+
+overload_level_t overload_level();
+const char *overload_level_name(overload_level_t level);
+
+/*Whether the pacman thread sends the frame of its tick number tick*/
+int overload_send_frame(uint64_t tick);
+
+/*Ghost moves per wakeup for the ghosts of slot*/
+int overload_ghost_batch(int slot);
+
+/*Blocks main while admission is paused. Returns early (-1) if a signal arrived*/
+int overload_admission_wait();
+
+#endif
@@ -2,11 +2,41 @@
 #define PARSER_H
 
 #include "board.h"
-#define MAX_COMMAND_LENGTH 256
+#define LINE_READER_CHUNK 4096
+#define PACMAN_MOVES "ADWSRGQ" // single letter moves, besides "T n"
+#define GHOST_MOVES "ADWSRC"
 
-int read_line(int fd, char* buffer);
-int read_level(board_t* board, char* filename, char* dirname);
-int read_pacman(board_t* board, int points);
-int read_ghosts(board_t* board);
+/*Files named by a level header, only needed while the level is read*/
+typedef struct {
+    char pacman_file[MAX_FILENAME]; // empty if the pacman is user controlled
+    char ghosts_files[MAX_GHOSTS][MAX_FILENAME];
+} level_files_t;
+
+/*Buffered reader of level, pacman and ghost files: one read() per chunk instead of one
+per character, and lines as long as the file has them (rows of wide maps, MON lines
+listing many ghosts)*/
+typedef struct {
+    int fd;
+    char *line; // the current line, without its newline
+    size_t line_len, line_cap;
+    size_t pos, len; // of buf
+    char buf[LINE_READER_CHUNK];
+} line_reader_t;
+
+/*Returns -1 if path can't be opened*/
+int line_reader_open(line_reader_t *r, const char *path);
+
+/*Moves r->line to the next line. Returns 1, 0 at the end of the file or -1 on error*/
+int line_reader_next(line_reader_t *r);
+
+void line_reader_close(line_reader_t *r);
+
+int read_level(board_t* board, level_files_t* files, char* filename, char* dirname);
+int read_pacman(board_t* board, level_files_t* files, int points);
+int read_ghosts(board_t* board, level_files_t* files);
+
+/*Reads only the moves of a pacman file, skipping its PASSO/POS header, into a new array
+(NULL if it has no moves). Returns the number of moves or -1*/
+int read_pacman_script(char* filename, command_t** moves);
 
 #endif
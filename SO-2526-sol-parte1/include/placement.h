@@ -0,0 +1,29 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+
+/*CPU placement of the sessions. The allowed CPUs are split into the admission CPU (main,
+loader and service threads) and groups of group_size CPUs for the sessions. A session is
+pinned to the least loaded group when a worker takes it; the pacman, ghost and listener
+threads inherit the pin, so a board's cache lines stay on one group.
+With a single CPU the admission thread shares it with the sessions*/
+
+/*Call before any thread is created, they inherit the admission pin.
+group_size 0 disables placement. Returns -1 if the affinity can not be read or set*/
+int placement_init(int group_size);
+
+/*Pins the calling thread to the group with the fewest sessions and counts the session
+there. Returns the group, or -1 if placement is off*/
+int placement_acquire();
+
+/*The session of group ended, the calling thread may run on any session CPU again*/
+void placement_release(int group);
+
+int placement_groups();
+int placement_sessions(int group);
+
+/*Writes the CPUs of group ("2-3", "5") into buf*/
+void placement_describe(int group, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef PLAYERS_H
+#define PLAYERS_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define PLAYER_KEY_LENGTH 40 // same as the pipe paths in the connect request
+
+typedef struct player_node {
+    char key[PLAYER_KEY_LENGTH];
+    struct player_node *next;
+} player_node_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    player_node_t *head;
+} player_bucket_t;
+
+/*Concurrent hash set of the players with an active session, keyed by request pipe.
+Each bucket has its own lock so admissions of different players never contend*/
+typedef struct {
+    size_t n_buckets; // power of two
+    player_bucket_t *buckets;
+} player_set_t;
+
+int player_set_init(player_set_t *set, size_t expected_players);
+void player_set_destroy(player_set_t *set);
+
+/*Returns 0 if the key was inserted and -1 if it is already in the set*/
+int player_set_insert(player_set_t *set, const char *key);
+
+void player_set_remove(player_set_t *set, const char *key);
+
+#endif
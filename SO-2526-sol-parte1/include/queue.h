@@ -0,0 +1,59 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_LINE 64
+
+typedef struct {
+    atomic_size_t seq; // sequence number of the position this cell can hold next
+    uint64_t enqueued_ns; // when the element was pushed (for residence time)
+} mpmc_cell_t;
+
+typedef struct {
+    uint64_t pushes, pops;
+    uint64_t push_wait_ns, push_wait_max_ns; // producers blocked on a full queue
+    uint64_t pop_wait_ns, pop_wait_max_ns; // consumers parked on an empty queue
+    uint64_t residence_ns, residence_max_ns; // time elements spent in the queue
+} mpmc_stats_t;
+
+/*Bounded lock-free multi-producer multi-consumer queue of fixed size elements.
+Blocking calls park on a futex, so an uncontended handoff never enters the kernel*/
+typedef struct {
+    size_t capacity;
+    size_t elem_size;
+    mpmc_cell_t *cells;
+    unsigned char *data;
+
+    _Alignas(CACHE_LINE) atomic_size_t head; // next position to push
+    _Alignas(CACHE_LINE) atomic_size_t tail; // next position to pop
+
+    _Alignas(CACHE_LINE) atomic_uint items_seq; // futex word, bumped on every push
+    atomic_uint pop_waiters;
+    _Alignas(CACHE_LINE) atomic_uint space_seq; // futex word, bumped on every pop
+    atomic_uint push_waiters;
+
+    _Alignas(CACHE_LINE) atomic_uint_fast64_t stats[8]; // same order as mpmc_stats_t
+} mpmc_queue_t;
+
+/*capacity >= 2: with a single cell a full cell looks free to the next push*/
+int mpmc_init(mpmc_queue_t *q, size_t capacity, size_t elem_size);
+void mpmc_destroy(mpmc_queue_t *q);
+
+/*Non blocking, return 0 on success and -1 if the queue is full/empty*/
+int mpmc_try_push(mpmc_queue_t *q, const void *elem);
+int mpmc_try_pop(mpmc_queue_t *q, void *elem);
+
+/*Blocking, timeout_ms < 0 waits forever.
+Return 0 on success or -1 with errno set to EINTR (signal) or ETIMEDOUT*/
+int mpmc_push(mpmc_queue_t *q, const void *elem, int timeout_ms);
+int mpmc_pop(mpmc_queue_t *q, void *elem, int timeout_ms);
+
+/*Approximate number of elements in the queue*/
+size_t mpmc_size(mpmc_queue_t *q);
+
+void mpmc_get_stats(mpmc_queue_t *q, mpmc_stats_t *stats);
+
+#endif
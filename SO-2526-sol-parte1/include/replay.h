@@ -0,0 +1,64 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "board.h"
+#include <stdint.h>
+
+/*Replay log of a session: the seed, the levels played and every step applied to the
+board in the order the state lock serialized them. Re-applying the steps to board.c
+reproduces the session regardless of thread timing.
+
+File layout: replay_header_t, then replay_record_t records. REPLAY_LEVEL is followed by
+arg bytes of level file name and REPLAY_LEVEL_END by a replay_check_t*/
+
+#define REPLAY_MAGIC 0x50524d50 // "PMRP"
+#define REPLAY_VERSION 1
+#define REPLAY_BUFFER (64 * 1024) // bytes buffered before a write
+
+typedef enum {
+    REPLAY_LEVEL = 1, // arg = name length
+    REPLAY_PACMAN, // arg = client command, 0 = next move of the file; value = result
+    REPLAY_GHOST, // arg = ghost index; value = result
+    REPLAY_CHECKPOINT, // periodic checkpoint ('G' is part of REPLAY_PACMAN)
+    REPLAY_RESTORE, // pacman killed by a ghost and restored
+    REPLAY_LEVEL_END, // value = how the level ended
+} replay_kind_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t seed;
+    uint32_t slot;
+} replay_header_t;
+
+typedef struct {
+    uint32_t time_ms; // since the session started
+    uint8_t kind;
+    uint8_t arg;
+    int16_t value;
+} replay_record_t;
+
+typedef struct {
+    int32_t points, pos_x, pos_y;
+} replay_check_t;
+
+typedef struct replay_writer replay_writer_t;
+
+/*Seed of the nth level of a session*/
+unsigned int replay_level_seed(unsigned int session_seed, int level_index);
+
+/*Starts the log of a session in dir. Returns NULL if it can not be created, every
+call below is a no-op on NULL*/
+replay_writer_t *replay_open(const char *dir, unsigned int seed, int slot);
+
+/*Appends a record. Writers of a session are serialized by the board state lock*/
+void replay_record(replay_writer_t *w, replay_kind_t kind, int arg, int value);
+
+void replay_level(replay_writer_t *w, const char *filename);
+void replay_level_end(replay_writer_t *w, int outcome, board_t *board);
+
+/*Flushes and closes the log*/
+void replay_close(replay_writer_t *w);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "metrics.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*Dispatcher mode (-s N). The process started by the user only fronts the register FIFO:
+it forks N shards, each a whole server with its own sessions, locks and admission queue,
+and forwards every OP_CODE_CONNECT to one of them through a FIFO of the shard's own
+(<register_pipe>.s<k>). A crash takes down the sessions of one shard only: the dispatcher
+starts it again, requests already forwarded wait in its FIFO.
+
+Shards report into a shared mapping made before the fork: requests done and sessions in
+course as they happen, the metric counters every SHARD_REPORT_MS. The dispatcher routes
+by the least load (requests forwarded and not done yet) or by consistent hashing of the
+client's request pipe, which keeps a client on the same shard while it is up.
+The shard FIFOs are written without blocking: a request that finds its shard's FIFO full
+goes to the next shard the policy picks. If all are full it waits in the dispatcher, and
+the clients after it in the register FIFO, until one has room*/
+
+#define MAX_SHARDS 64
+#define SHARD_VNODES 64 // points of each shard on the hash ring
+#define SHARD_REPORT_MS 100
+#define SHARD_RESTART_MS 1000 // a shard that lived less than this is restarted after it
+
+typedef enum {
+    SHARD_LEAST_LOAD = 0,
+    SHARD_HASH,
+} shard_policy_t;
+
+typedef struct {
+    atomic_int pid; // 0 while the shard is down
+    atomic_int sessions; // requests the shard is handling
+    atomic_ulong forwarded; // by the dispatcher, since the shard (re)started
+    atomic_ulong done; // requests the shard finished with: session over or rejected
+    atomic_ulong reported_ns; // last report of the counters
+    atomic_ulong counters[METRIC_COUNTERS];
+} shard_stats_t;
+
+/*Starts the dispatcher, before any thread is created. Returns in every shard its index,
+the shard goes on as a normal server on shard_pipe(). In the dispatcher it only returns
+-1, if it could not start*/
+int shard_dispatch(int n_shards, shard_policy_t policy, const char *register_pipe);
+
+/*The shard this process is, -1 without a dispatcher*/
+int shard_index();
+
+/*The FIFO the dispatcher forwards this shard's requests to, already created*/
+const char *shard_pipe();
+
+/*Starts the thread publishing the metric counters of this shard. No-op unsharded*/
+int shard_start_reporter();
+
+/*A worker took a request / is done with it. No-op unsharded*/
+void shard_request_taken();
+void shard_request_done();
+
+#endif
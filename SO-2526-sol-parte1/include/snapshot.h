@@ -0,0 +1,47 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "board.h"
+#include <stdint.h>
+
+/*One cell in compact form (the lock is not part of the state)*/
+typedef struct {
+    char content;
+    unsigned char flags; // CELL_DOT | CELL_PORTAL
+} snapshot_cell_t;
+
+#define CELL_DOT 1
+#define CELL_PORTAL 2
+
+/*In-memory checkpoint of a level: cells, entities and their move counters.
+The cells are kept in pages of BOARD_PAGE_CELLS and only the pages the board marked
+dirty are copied, both when checkpointing and when restoring*/
+typedef struct board_snapshot {
+    int valid; // a checkpoint was taken
+    int n_pages;
+    snapshot_cell_t *cells; // n_pages * BOARD_PAGE_CELLS
+    int n_pacmans, n_ghosts;
+    pacman_t *pacmans;
+    ghost_t *ghosts;
+    unsigned int rng_state;
+} board_snapshot_t;
+
+int snapshot_init(board_snapshot_t *snap, board_t *board);
+
+/*Bytes snapshot_init allocates for board*/
+size_t snapshot_bytes(board_t *board);
+void snapshot_free(board_snapshot_t *snap);
+
+/*snapshot_take and snapshot_restore require board->state_lock held for writing*/
+void snapshot_take(board_snapshot_t *snap, board_t *board);
+
+/*Consumes the checkpoint, so a pacman that dies again needs a new one.
+Returns -1 if there is no checkpoint*/
+int snapshot_restore(board_snapshot_t *snap, board_t *board);
+
+/*Brings the whole board back to the checkpoint, whatever the dirty pages say, and keeps
+the checkpoint so the board can be reset again (a level replayed many times).
+Every page is left dirty, as after load_level*/
+void snapshot_reset(board_snapshot_t *snap, board_t *board);
+
+#endif
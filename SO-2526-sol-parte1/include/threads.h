@@ -0,0 +1,35 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Explicit stack sizes (glibc defaults to 8 MB per thread)
+#define WORKER_STACK_SIZE (256 * 1024) // runs run_game_session and load_level
+#define SESSION_STACK_SIZE (64 * 1024) // pacman, ghost and input listener threads
+
+typedef enum {
+    THREAD_WORKER = 0,
+    THREAD_PACMAN,
+    THREAD_GHOST,
+    THREAD_LISTENER,
+    THREAD_LOADER, // background level preloading
+    THREAD_SERVICE, // background threads of the server (metrics exporter, ...)
+    THREAD_CLASSES,
+} thread_class_t;
+
+/*Creates a thread with the stack size of its class and counts it.
+Detached threads must call thread_exited() before returning*/
+int spawn_thread(pthread_t *tid, thread_class_t cls, void *(*fn)(void *), void *arg, int detached);
+
+/*Joins a thread created by spawn_thread and counts it as reaped*/
+int join_thread(pthread_t tid, thread_class_t cls, void **retval);
+
+/*Counts a detached thread as reaped*/
+void thread_exited(thread_class_t cls);
+
+unsigned long threads_created(thread_class_t cls);
+unsigned long threads_reaped(thread_class_t cls);
+const char *thread_class_name(thread_class_t cls);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*Central hierarchical timing wheel (1 ms resolution). One driver thread sleeps on
+absolute CLOCK_MONOTONIC deadlines and wakes the threads whose timers expired,
+instead of every entity thread running its own nanosleep*/
+
+#define WHEEL_L0_BITS 8 // 256 slots of 1 ms
+#define WHEEL_LN_BITS 6 // 64 slots per upper level
+#define WHEEL_LEVELS 4 // covers 2^26 ms (~18 h), longer timers are clamped
+
+/*Clock the wheel runs on. TIMER_CLOCK_VIRTUAL does not follow the wall clock: time stands
+still while any thread that owns a ticker is running, and once all of them wait on the
+wheel it jumps straight to the next deadline. Ticks keep their order and spacing, only
+the idle time between them is skipped*/
+typedef enum {
+    TIMER_CLOCK_REAL,
+    TIMER_CLOCK_VIRTUAL,
+} timer_clock_t;
+
+typedef struct timer_node {
+    uint64_t expires; // absolute wheel tick (ms)
+    atomic_uint fired; // futex word the owner sleeps on
+    struct timer_node *next;
+    struct timer_node **pprev; // link that points to this node, NULL when not armed
+} timer_node_t;
+
+/*Periodic deadline of one thread. Deadlines are absolute (start + k * period), so
+the period does not drift by the time spent working*/
+typedef struct {
+    timer_node_t node;
+    uint64_t next_ns; // next deadline
+    uint64_t period_ns;
+    uint64_t ticks;
+    uint64_t overruns; // ticks that started after their deadline had passed
+    atomic_ulong *session_overruns; // shared by every thread of a session, may be NULL
+    int cancelled; // set by ticker_cancel (wheel lock held)
+} ticker_t;
+
+/*Must be called before the first ticker_init*/
+void timer_set_clock(timer_clock_t clock);
+
+/*Current time of the wheel clock in ns*/
+uint64_t timer_now_ns();
+
+/*First deadline is one period from now. With the virtual clock the owner counts as
+running until it waits on the ticker or the ticker is cancelled*/
+void ticker_init(ticker_t *t, int period_ms, atomic_ulong *session_overruns);
+
+/*Sleeps until the next deadline. If it already passed the tick is late: it counts as an
+overrun, whole missed periods are dropped and the call returns at once.
+Returns the number of periods missed*/
+int ticker_wait(ticker_t *t);
+
+/*The next ticker_wait sleeps periods more deadlines, for an owner that did their work
+ahead. Owner only*/
+void ticker_skip(ticker_t *t, int periods);
+
+/*Wakes the owner of the ticker now and makes every later ticker_wait return at once.
+Used to stop a thread that may be sleeping for a long period, and by the owner itself
+when it stops using the ticker*/
+void ticker_cancel(ticker_t *t);
+
+/*Timers currently armed in the wheel*/
+int timer_wheel_pending();
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+
+/*Timeline tracing. While a recording is on, every thread appends timestamped begin/end
+events to its own buffer (no locks, no syscalls). trace_stop writes the recording as
+Chrome trace JSON (chrome://tracing, ui.perfetto.dev), one process per session.
+When tracing is off an event costs one relaxed load*/
+
+#define TRACE_EVENTS (32 * 1024) // per thread and recording, later events are dropped
+#define TRACE_CHUNK 1024 // events a thread buffer grows by, taken as they are recorded
+#define TRACE_MAX_CHUNKS 2048 // all threads together (about 48 MB), then events are dropped
+#define TRACE_NAME 32
+
+extern atomic_int trace_on;
+
+void trace_record(const char *name, char phase);
+
+/*name must be a string literal (only the pointer is kept)*/
+static inline void trace_begin(const char *name) {
+    if (atomic_load_explicit(&trace_on, memory_order_relaxed)) trace_record(name, 'B');
+}
+
+static inline void trace_end(const char *name) {
+    if (atomic_load_explicit(&trace_on, memory_order_relaxed)) trace_record(name, 'E');
+}
+
+/*Names the calling thread in the timeline. session < 0 groups it with the server threads*/
+void trace_thread(int session, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/*Starts a recording, dropping the previous one*/
+void trace_start();
+
+/*Ends the recording and writes it to path, then frees the events of the threads that
+exited. Returns the number of events or -1*/
+long trace_stop(const char *path);
+
+#endif
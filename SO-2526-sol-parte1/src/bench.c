@@ -0,0 +1,420 @@
+#include "board.h"
+#include "parser.h"
+#include "manifest.h"
+#include "frame.h"
+#include "protocol.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define DEFAULT_REPS 200
+#define DEFAULT_WARMUP 20
+#define MAX_SIZES 8
+#define MAX_COUNTS 8
+#define KILL_BATCH 1024 // find_and_kill_pacman calls per sample
+#define CHARGE_BATCH 16 // charged slides per sample
+#define MIN_SIDE 10 // room for the corridors, the parking spots and a ghost area
+#define VIEW_COLS 80
+#define VIEW_ROWS 24
+
+/*Every benchmark is a function timing one sample of ops operations. Samples are
+repeated after a warmup and reported in ns per operation as one JSON object per line,
+so two runs can be diffed or loaded as they are*/
+
+typedef struct {
+    int width, height, n_ghosts;
+    char dir;
+    int ops;
+    board_t *board;
+    unsigned char *packet;
+    const frame_view_t *view;
+    size_t packet_len;
+    const char *path; // corpus benchmarks
+    char *filename;
+    char *dirname;
+} bench_ctx_t;
+
+typedef uint64_t (*bench_fn)(bench_ctx_t *ctx);
+
+static int reps = DEFAULT_REPS;
+static int warmup = DEFAULT_WARMUP;
+
+static int double_cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of sorted samples
+static double percentile(const double *sorted, int n, double p) {
+    int rank = (int)ceil(p / 100.0 * n);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Runs fn warmup + reps times and prints the distribution of ns per operation
+static void run(const char *name, const char *variant, bench_fn fn, bench_ctx_t *ctx) {
+    double *samples = malloc(reps * sizeof(double));
+    for (int i = 0; i < warmup; i++) fn(ctx);
+    for (int i = 0; i < reps; i++) samples[i] = (double)fn(ctx) / ctx->ops;
+
+    double sum = 0;
+    for (int i = 0; i < reps; i++) sum += samples[i];
+    double mean = sum / reps, var = 0;
+    for (int i = 0; i < reps; i++) var += (samples[i] - mean) * (samples[i] - mean);
+    qsort(samples, reps, sizeof(double), double_cmp);
+
+    printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"width\":%d,\"height\":%d,\"ghosts\":%d,"
+           "\"ops\":%d,\"samples\":%d,\"unit\":\"ns/op\",\"min\":%.2f,\"p50\":%.2f,\"p90\":%.2f,"
+           "\"p99\":%.2f,\"max\":%.2f,\"mean\":%.2f,\"stddev\":%.2f}\n",
+           name, variant, ctx->width, ctx->height, ctx->n_ghosts, ctx->ops, reps, samples[0],
+           percentile(samples, reps, 50), percentile(samples, reps, 90), percentile(samples, reps, 99),
+           samples[reps - 1], mean, reps > 1 ? sqrt(var / (reps - 1)) : 0.0);
+    fflush(stdout);
+    free(samples);
+}
+
+// Walls on the border, dots everywhere else. The pacman runs its corridors on row and
+// column 1, ghost 0 on row and column 2, and both park in the bottom right corner while
+// the other one runs. The other ghosts stand from row and column 4 on
+static int build_board(board_t *board, int width, int height, int n_ghosts) {
+    // Every third cell of the ghost area, ghosts wander with 'R'
+    int area_w = width - 7, area_h = height - 7;
+    if ((long)(n_ghosts - 2) * 3 / area_w >= area_h) return -1;
+
+    memset(board, 0, sizeof(board_t));
+    board->width = width;
+    board->height = height;
+    board->tempo = 1;
+    board->session_slot = -1;
+    board->rng_state = 1;
+    board->n_pacmans = 1;
+    board->n_ghosts = n_ghosts;
+    board->level_name = strdup("bench");
+    board->board = calloc((size_t)width * height, sizeof(board_pos_t));
+    board->pacmans = calloc(1, sizeof(pacman_t));
+    board->ghosts = calloc(n_ghosts, sizeof(ghost_t));
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            board_pos_t *cell = &board->board[(size_t)y * width + x];
+            int border = x == 0 || y == 0 || x == width - 1 || y == height - 1;
+            cell->content = border ? 'W' : ' ';
+            cell->has_dot = !border;
+        }
+    }
+
+    pacman_t *pac = &board->pacmans[0];
+    pac->alive = 1;
+    pac->pos_x = width - 2;
+    pac->pos_y = height - 2;
+    board->board[(size_t)pac->pos_y * width + pac->pos_x].content = 'P';
+
+    for (int i = 0; i < n_ghosts; i++) {
+        ghost_t *g = &board->ghosts[i];
+        g->moves = malloc(sizeof(command_t));
+        g->moves[0] = (command_t){ .command = 'R', .turns = 1 };
+        g->n_moves = 1;
+        if (i == 0) {
+            g->pos_x = width - 3;
+            g->pos_y = height - 2;
+        }
+        else {
+            long at = (long)(i - 1) * 3;
+            g->pos_x = 4 + at % area_w;
+            g->pos_y = 4 + at / area_w;
+        }
+        board->board[(size_t)g->pos_y * width + g->pos_x].content = 'M';
+    }
+
+    // As load_level leaves a board
+    pthread_rwlock_init(&board->state_lock, NULL);
+    board->n_pages = (width * height + BOARD_PAGE_CELLS - 1) / BOARD_PAGE_CELLS;
+    board->dirty_pages = calloc(board->n_pages, 1);
+    for (int i = 0; i < CELL_LOCK_STRIPES; i++) pthread_mutex_init(&board->cell_locks[i], NULL);
+    board->bytes = board_bytes(board);
+    return 0;
+}
+
+static void place(board_t *board, int *pos_x, int *pos_y, int x, int y, char content) {
+    board->board[(size_t)*pos_y * board->width + *pos_x].content = ' ';
+    *pos_x = x;
+    *pos_y = y;
+    board->board[(size_t)y * board->width + x].content = content;
+}
+
+// Start of the corridor on line (a row for A/D, a column for W/S) walked towards dir,
+// and the number of moves to its end
+static int corridor(board_t *board, char dir, int line, int *x, int *y) {
+    switch (dir) {
+        case 'D': *x = 1; *y = line; return board->width - 3;
+        case 'A': *x = board->width - 2; *y = line; return board->width - 3;
+        case 'S': *x = line; *y = 1; return board->height - 3;
+        default: *x = line; *y = board->height - 2; return board->height - 3;
+    }
+}
+
+// Puts the dots of a corridor back
+static void refill(board_t *board, char dir, int line) {
+    if (dir == 'A' || dir == 'D') {
+        for (int x = 1; x < board->width - 1; x++) board->board[(size_t)line * board->width + x].has_dot = 1;
+    }
+    else {
+        for (int y = 1; y < board->height - 1; y++) board->board[(size_t)y * board->width + line].has_dot = 1;
+    }
+}
+
+static void park(board_t *board) {
+    pacman_t *pac = &board->pacmans[0];
+    ghost_t *g = &board->ghosts[0];
+    place(board, &pac->pos_x, &pac->pos_y, board->width - 2, board->height - 2, 'P');
+    place(board, &g->pos_x, &g->pos_y, board->width - 3, board->height - 2, 'M');
+}
+
+// One walk of the pacman down its corridor, eating every dot
+static uint64_t bench_move_pacman(bench_ctx_t *ctx) {
+    board_t *board = ctx->board;
+    pacman_t *pac = &board->pacmans[0];
+    int x, y;
+    ctx->ops = corridor(board, ctx->dir, 1, &x, &y);
+    refill(board, ctx->dir, 1);
+    place(board, &pac->pos_x, &pac->pos_y, x, y, 'P');
+
+    command_t command = { .command = ctx->dir, .turns = 1 };
+    uint64_t start = metrics_now_ns();
+    for (int i = 0; i < ctx->ops; i++) move_pacman(board, 0, &command);
+    return metrics_now_ns() - start;
+}
+
+static uint64_t bench_move_ghost(bench_ctx_t *ctx) {
+    board_t *board = ctx->board;
+    ghost_t *g = &board->ghosts[0];
+    int x, y;
+    ctx->ops = corridor(board, ctx->dir, 2, &x, &y);
+    place(board, &g->pos_x, &g->pos_y, x, y, 'M');
+    g->charged = 0;
+
+    command_t command = { .command = ctx->dir, .turns = 1 };
+    uint64_t start = metrics_now_ns();
+    for (int i = 0; i < ctx->ops; i++) move_ghost(board, 0, &command);
+    return metrics_now_ns() - start;
+}
+
+// Slides from one end of the corridor to the other. Putting the ghost back at the start
+// (two stores) is timed with them
+static uint64_t bench_move_ghost_charged(bench_ctx_t *ctx) {
+    board_t *board = ctx->board;
+    ghost_t *g = &board->ghosts[0];
+    int x, y;
+    corridor(board, ctx->dir, 2, &x, &y);
+    ctx->ops = CHARGE_BATCH;
+
+    uint64_t start = metrics_now_ns();
+    for (int i = 0; i < CHARGE_BATCH; i++) {
+        place(board, &g->pos_x, &g->pos_y, x, y, 'M');
+        move_ghost_charged(board, 0, ctx->dir);
+    }
+    return metrics_now_ns() - start;
+}
+
+// ctx->dir 'h': the pacman is there and dies (brought back by two stores), 'm': it isn't
+static uint64_t bench_find_and_kill(bench_ctx_t *ctx) {
+    board_t *board = ctx->board;
+    pacman_t *pac = &board->pacmans[0];
+    int hit = ctx->dir == 'h';
+    int x = hit ? pac->pos_x : 1, y = hit ? pac->pos_y : 1;
+    size_t idx = (size_t)pac->pos_y * board->width + pac->pos_x;
+    ctx->ops = KILL_BATCH;
+
+    uint64_t start = metrics_now_ns();
+    for (int i = 0; i < KILL_BATCH; i++) {
+        find_and_kill_pacman(board, x, y);
+        pac->alive = 1;
+        board->board[idx].content = 'P';
+    }
+    return metrics_now_ns() - start;
+}
+
+// Every ghost takes one 'R' step, a ghost tick of the whole level
+static uint64_t bench_ghost_tick(bench_ctx_t *ctx) {
+    board_t *board = ctx->board;
+    ctx->ops = board->n_ghosts;
+    uint64_t start = metrics_now_ns();
+    for (int i = 0; i < board->n_ghosts; i++) play_ghost(board, i);
+    uint64_t elapsed = metrics_now_ns() - start;
+    board->pacmans[0].alive = 1; // a ghost may have walked into it
+    return elapsed;
+}
+
+// What send_board_update encodes
+static uint64_t bench_frame_encode(bench_ctx_t *ctx) {
+    ctx->ops = 1;
+    uint64_t start = metrics_now_ns();
+    ctx->packet_len = frame_encode(ctx->board, 0, 0, ctx->view, ctx->packet);
+    return metrics_now_ns() - start;
+}
+
+/*What the client's receive_board_update does with a frame once its bytes are read: the
+header into the board struct, the cells into a new buffer (freed, as the client does
+after drawing)*/
+static uint64_t bench_frame_decode(bench_ctx_t *ctx) {
+    const unsigned char *p = ctx->packet;
+    ctx->ops = 1;
+    uint64_t start = metrics_now_ns();
+
+    int32_t values[FRAME_METADATA], view[FRAME_VIEW_METADATA] = {0};
+    memcpy(values, p + 1, sizeof(values));
+    size_t off = FRAME_HEADER;
+    if (p[0] == OP_CODE_BOARD_VIEW) {
+        memcpy(view, p + off, sizeof(view));
+        off = FRAME_VIEW_HEADER;
+    }
+    size_t cells = (size_t)values[0] * values[1];
+    char *data = malloc(cells);
+    memcpy(data, p + off, cells);
+    volatile char sink = data[cells - 1] + (char)view[0];
+    (void)sink;
+    free(data);
+
+    return metrics_now_ns() - start;
+}
+
+// Every line of a level file through the line reader
+static uint64_t bench_line_reader(bench_ctx_t *ctx) {
+    line_reader_t r;
+    int lines = 0;
+    uint64_t start = metrics_now_ns();
+    if (line_reader_open(&r, ctx->path) == 0) {
+        while (line_reader_next(&r) > 0) lines++;
+        line_reader_close(&r);
+    }
+    uint64_t elapsed = metrics_now_ns() - start;
+    ctx->ops = lines > 0 ? lines : 1;
+    return elapsed;
+}
+
+static uint64_t bench_load_level(bench_ctx_t *ctx) {
+    board_t board = {0};
+    ctx->ops = 1;
+    uint64_t start = metrics_now_ns();
+    if (load_level(&board, ctx->filename, ctx->dirname, 0) == 0) unload_level(&board);
+    return metrics_now_ns() - start;
+}
+
+static void run_board(int width, int height, int n_ghosts) {
+    board_t board;
+    bench_ctx_t ctx = { .width = width, .height = height, .n_ghosts = n_ghosts, .board = &board };
+    if (build_board(&board, width, height, n_ghosts) != 0) {
+        fprintf(stderr, "Tabuleiro %dx%d sem espaço para %d fantasmas\n", width, height, n_ghosts);
+        return;
+    }
+
+    static const char dirs[] = "WASD";
+    char variant[2] = {0};
+    for (int d = 0; d < 4; d++) {
+        ctx.dir = variant[0] = dirs[d];
+        park(&board);
+        run("move_pacman", variant, bench_move_pacman, &ctx);
+        park(&board);
+        run("move_ghost", variant, bench_move_ghost, &ctx);
+        park(&board);
+        run("move_ghost_charged", variant, bench_move_ghost_charged, &ctx);
+    }
+    park(&board);
+
+    ctx.dir = 'h';
+    run("find_and_kill_pacman", "hit", bench_find_and_kill, &ctx);
+    ctx.dir = 'm';
+    run("find_and_kill_pacman", "miss", bench_find_and_kill, &ctx);
+
+    frame_view_t view = { VIEW_COLS, VIEW_ROWS };
+    ctx.packet = malloc(frame_size(&board, NULL));
+    ctx.view = NULL;
+    run("frame_encode", "board", bench_frame_encode, &ctx);
+    run("frame_decode", "board", bench_frame_decode, &ctx);
+    ctx.view = &view;
+    run("frame_encode", "view", bench_frame_encode, &ctx);
+    run("frame_decode", "view", bench_frame_decode, &ctx);
+    free(ctx.packet);
+
+    run("ghost_tick", "R", bench_ghost_tick, &ctx);
+    unload_level(&board);
+}
+
+// load_level and the line reader on every level of a corpus (see bin/levelgen)
+static void run_corpus(const char *dir) {
+    if (manifest_load(dir) != 0) {
+        perror("Erro ao ler a diretoria de níveis");
+        return;
+    }
+    level_manifest_t *manifest = manifest_acquire();
+    for (int l = 0; l < manifest->n_levels; l++) {
+        level_info_t *info = &manifest->levels[l];
+        char path[2 * MAX_FILENAME];
+        snprintf(path, sizeof(path), "%s/%s", manifest->dir, info->filename);
+        bench_ctx_t ctx = {
+            .width = info->width, .height = info->height, .n_ghosts = info->n_ghosts,
+            .path = path, .filename = info->filename, .dirname = manifest->dir,
+        };
+        run("line_reader", info->filename, bench_line_reader, &ctx);
+        run("load_level", info->filename, bench_load_level, &ctx);
+    }
+    manifest_release(manifest);
+}
+
+// "WxH" into width and height
+static int parse_size(const char *arg, int *width, int *height) {
+    return sscanf(arg, "%dx%d", width, height) == 2 && *width >= MIN_SIDE && *height >= MIN_SIDE ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int widths[MAX_SIZES] = { 32, 256, 2048 }, heights[MAX_SIZES] = { 16, 128, 1024 };
+    int counts[MAX_COUNTS] = { 4, MAX_GHOSTS - 1 };
+    int n_sizes = 0, n_counts = 0, bad = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:b:g:")) != -1) {
+        switch (opt) {
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 'b':
+                if (n_sizes == MAX_SIZES || parse_size(optarg, &widths[n_sizes], &heights[n_sizes]) != 0) bad = 1;
+                else n_sizes++;
+                break;
+            case 'g':
+                if (n_counts == MAX_COUNTS || (counts[n_counts] = atoi(optarg)) < 1 || counts[n_counts] > MAX_GHOSTS - 1) bad = 1;
+                else n_counts++;
+                break;
+            default:
+                bad = 1;
+        }
+    }
+    if (n_sizes == 0) n_sizes = 3;
+    if (n_counts == 0) n_counts = 2;
+
+    if (bad || reps <= 0 || warmup < 0) {
+        fprintf(stderr, "Uso: %s [-r repetições] [-w aquecimento] [-b LxA]... [-g fantasmas]... [levels_dir]\n"
+                        "   tabuleiros de pelo menos %dx%d, 1 a %d fantasmas, até %d de cada opção\n",
+                argv[0], MIN_SIDE, MIN_SIDE, MAX_GHOSTS - 1, MAX_SIZES);
+        return 1;
+    }
+
+    // The timer's own cost, to read the cheap benchmarks against
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t a = metrics_now_ns(), b = metrics_now_ns();
+        if (b - a < overhead) overhead = b - a;
+    }
+    printf("{\"bench\":\"meta\",\"samples\":%d,\"warmup\":%d,\"timer_ns\":%llu,\"cpus\":%ld}\n",
+           reps, warmup, (unsigned long long)overhead, sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (int s = 0; s < n_sizes; s++) {
+        for (int c = 0; c < n_counts; c++) run_board(widths[s], heights[s], counts[c]);
+    }
+    if (optind < argc) run_corpus(argv[optind]);
+    return 0;
+}
@@ -1,17 +1,32 @@
 #include "board.h"
 #include "parser.h"
+#include "leaderboard.h"
+#include "snapshot.h"
+#include "log.h"
+#include "trace.h"
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h> //snprintf
 #include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
-#include <stdarg.h>
 #include <pthread.h>
+#include <stdint.h>
 
-FILE * debugfile;
+#define CELL_STRIPE(index) (1ull << ((index) % CELL_LOCK_STRIPES))
 
-// Helper private function to find and kill pacman at specific position
-static int find_and_kill_pacman(board_t* board, int new_x, int new_y) {
+// Stripes are always taken in increasing order, so movers holding several of them
+// (a charged ghost takes a whole row) can not deadlock. Macros, so the lock profiler
+// counts each caller apart
+#define LOCK_STRIPES(board, mask) do { \
+    for (uint64_t m_ = (mask); m_; m_ &= m_ - 1) CELL_LOCK(&(board)->cell_locks[__builtin_ctzll(m_)]); \
+} while (0)
+
+#define UNLOCK_STRIPES(board, mask) do { \
+    for (uint64_t m_ = (mask); m_; m_ &= m_ - 1) CELL_UNLOCK(&(board)->cell_locks[__builtin_ctzll(m_)]); \
+} while (0)
+
+int find_and_kill_pacman(board_t* board, int new_x, int new_y) {
     for (int p = 0; p < board->n_pacmans; p++) {
         pacman_t* pac = &board->pacmans[p];
         if (pac->pos_x == new_x && pac->pos_y == new_y && pac->alive) {
@@ -28,6 +43,11 @@ static inline int get_board_index(board_t* board, int x, int y) {
     return y * board->width + x;
 }
 
+// Records that a cell changed since the last checkpoint
+static inline void mark_dirty(board_t* board, int index) {
+    board->dirty_pages[index / BOARD_PAGE_CELLS] = 1;
+}
+
 // Helper private function for checking valid position
 static inline int is_valid_position(board_t* board, int x, int y) {
     return (x >= 0 && x < board->width) && (y >= 0 && y < board->height); // Inside of the board boundaries
@@ -60,7 +80,7 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
 
     if (direction == 'R') {
         char directions[] = {'W', 'S', 'A', 'D'};
-        direction = directions[rand() % 4];
+        direction = directions[rand_r(&board->rng_state) % 4];
     }
 
     // Calculate new position based on direction
@@ -78,11 +98,9 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
             new_x++;
             break;
         case 'T': // Wait
-            if (command->turns_left == 1) {
-                pac->current_move += 1; // move on
-                command->turns_left = command->turns;
-            }
-            else command->turns_left -= 1;
+            if (command->turns == 0) return VALID_MOVE;
+            if (pac->turns_left == 0) pac->turns_left = command->turns;
+            if (--pac->turns_left == 0) pac->current_move += 1; // move on
             return VALID_MOVE;
         default:
             return INVALID_MOVE; // Invalid direction
@@ -100,21 +118,19 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     int old_index = get_board_index(board, pac->pos_x, pac->pos_y);
 
     // locks
-    if (old_index < new_index) {
-        pthread_mutex_lock(&board->board[old_index].lock);
-        pthread_mutex_lock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_lock(&board->board[new_index].lock);
-        pthread_mutex_lock(&board->board[old_index].lock);
-    }
+    uint64_t stripes = CELL_STRIPE(old_index) | CELL_STRIPE(new_index);
+    trace_begin("cell_locks");
+    LOCK_STRIPES(board, stripes);
+    trace_end("cell_locks");
 
     char target_content = board->board[new_index].content;
 
     if (board->board[new_index].has_portal) {
         board->board[old_index].content = ' ';
+        mark_dirty(board, old_index);
         board->board[new_index].content = 'P';
-        return REACHED_PORTAL;
+        mark_dirty(board, new_index);
+        goto move_pacman_portal;
     }
 
     // Check for walls
@@ -135,42 +151,73 @@ int move_pacman(board_t* board, int pacman_index, command_t* command) {
     }
 
     board->board[old_index].content = ' ';
+    mark_dirty(board, old_index);
     pac->pos_x = new_x;
     pac->pos_y = new_y;
     board->board[new_index].content = 'P';
+    mark_dirty(board, new_index);
 
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
-    }
+    UNLOCK_STRIPES(board, stripes);
+
+    // Incremental ranking, only reorders the top-K when the points changed
+    leaderboard_update(board->session_slot, pac->points, new_x, new_y);
     
     return VALID_MOVE;
 
+    move_pacman_portal:
+    UNLOCK_STRIPES(board, stripes);
+    return REACHED_PORTAL;
+
     move_pacman_invalid:
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
-    }
+    UNLOCK_STRIPES(board, stripes);
     return INVALID_MOVE;
 
     move_pacman_dead:
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
+    UNLOCK_STRIPES(board, stripes);
+    return DEAD_PACMAN;
+}
+
+int play_pacman(board_t* board, int pacman_index, char command, board_snapshot_t* checkpoint) {
+    pacman_t* pac = &board->pacmans[pacman_index];
+    command_t c_struct = {0};
+    command_t* play;
+
+    if (command != '\0') {
+        c_struct.command = command;
+        c_struct.turns = 0;
+        play = &c_struct;
+    }
+    else if (pac->n_moves > 0) {
+        play = &pac->moves[pac->current_move % pac->n_moves];
     }
     else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
+        return VALID_MOVE;
     }
-    return DEAD_PACMAN;
+
+    if (play->command == 'G') {
+        // A restore resumes at the move after the checkpoint
+        if (play != &c_struct) pac->current_move++;
+        if (checkpoint) snapshot_take(checkpoint, board);
+        return VALID_MOVE;
+    }
+
+    trace_begin("move_pacman");
+    int res = move_pacman(board, pacman_index, play);
+    trace_end("move_pacman");
+    if (res == DEAD_PACMAN && checkpoint && snapshot_restore(checkpoint, board) == 0) {
+        leaderboard_update(board->session_slot, pac->points, pac->pos_x, pac->pos_y);
+        res = RESTORED_PACMAN;
+    }
+    return res;
+}
+
+int play_ghost(board_t* board, int ghost_index) {
+    ghost_t* ghost = &board->ghosts[ghost_index];
+    if (ghost->n_moves == 0) return VALID_MOVE; // a ghost file without moves stands still
+    trace_begin("move_ghost");
+    int res = move_ghost(board, ghost_index, &ghost->moves[ghost->current_move % ghost->n_moves]);
+    trace_end("move_ghost");
+    return res;
 }
 
 int move_ghost_charged(board_t* board, int ghost_index, char direction) {
@@ -179,7 +226,8 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
     int y = ghost->pos_y;
     int new_x = x;
     int new_y = y;
-    int result;
+    int result = VALID_MOVE; // sliding to the edge without a collision
+    uint64_t stripes = 0; // of the cells from the ghost to the edge
 
     ghost->charged = 0; //uncharge
 
@@ -187,9 +235,8 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
         case 'W':
             if (y == 0) return INVALID_MOVE;
 
-            for (int i = 0; i <= y; i++) {
-                pthread_mutex_lock(&board->board[i * board->width + x].lock);
-            }
+            for (int i = 0; i <= y; i++) stripes |= CELL_STRIPE(i * board->width + x);
+            LOCK_STRIPES(board, stripes);
 
             new_y = 0; // In case there is no colision
             for (int i = y - 1; i >= 0; i--) {
@@ -206,16 +253,13 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
                 }
             }
 
-            for (int i = 0; i <= y; i++) {
-                pthread_mutex_unlock(&board->board[i * board->width + x].lock);
-            }
+            UNLOCK_STRIPES(board, stripes);
             break;
         case 'S':
             if (y == board->height - 1) return INVALID_MOVE;
 
-            for (int i = y; i < board->height; i++) {
-                pthread_mutex_lock(&board->board[i * board->width + x].lock);
-            }
+            for (int i = y; i < board->height; i++) stripes |= CELL_STRIPE(i * board->width + x);
+            LOCK_STRIPES(board, stripes);
 
             new_y = board->height - 1; // In case there is no colision
             for (int i = y + 1; i < board->height; i++) {
@@ -232,16 +276,13 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
                 }
             }
 
-            for (int i = y; i < board->height; i++) {
-                pthread_mutex_unlock(&board->board[i * board->width + x].lock);
-            }
+            UNLOCK_STRIPES(board, stripes);
             break;
         case 'A':
             if (x == 0) return INVALID_MOVE;
 
-            for (int j = 0; j <= x; j++) {
-                pthread_mutex_lock(&board->board[y * board->width + j].lock);
-            }
+            for (int j = 0; j <= x; j++) stripes |= CELL_STRIPE(y * board->width + j);
+            LOCK_STRIPES(board, stripes);
 
             new_x = 0; // In case there is no colision
             for (int j = x - 1; j >= 0; j--) {
@@ -258,16 +299,13 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
                 }
             }
 
-            for (int j = 0; j <= x; j++) {
-                pthread_mutex_unlock(&board->board[y * board->width + j].lock);
-            }
+            UNLOCK_STRIPES(board, stripes);
             break;
         case 'D':
             if (x == board->width - 1) return INVALID_MOVE;
 
-            for (int j = x; j < board->width; j++) {
-                pthread_mutex_lock(&board->board[y * board->width + j].lock);
-            }
+            for (int j = x; j < board->width; j++) stripes |= CELL_STRIPE(y * board->width + j);
+            LOCK_STRIPES(board, stripes);
 
             new_x = board->width - 1; // In case there is no colision
             for (int j = x + 1; j < board->width; j++) {
@@ -284,16 +322,15 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
                 }
             }
 
-            for (int j = x; j < board->width; j++) {
-                pthread_mutex_unlock(&board->board[y * board->width + j].lock);
-            }
+            UNLOCK_STRIPES(board, stripes);
             break;
         default:
-            debug("DEFAULT CHARGED MOVE - direction = %c\n", direction);
+            log_warn("DEFAULT CHARGED MOVE - direction = %c\n", direction);
             return INVALID_MOVE;
     }
 
     board->board[y * board->width + x].content = ' '; // Or restore the dot if ghost was on one
+    mark_dirty(board, y * board->width + x);
 
     // Update ghost position
     ghost->pos_x = new_x;
@@ -301,6 +338,7 @@ int move_ghost_charged(board_t* board, int ghost_index, char direction) {
 
     // Update board - set new position
     board->board[new_y * board->width + new_x].content = 'M';
+    mark_dirty(board, new_y * board->width + new_x);
     return result;
 }
 
@@ -320,7 +358,7 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
 
     if (direction == 'R') {
         char directions[] = {'W', 'S', 'A', 'D'};
-        direction = directions[rand() % 4];
+        direction = directions[rand_r(&board->rng_state) % 4];
     }
 
     // Calculate new position based on direction
@@ -342,11 +380,8 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
             ghost->charged = 1;
             return VALID_MOVE;
         case 'T': // Wait
-            if (command->turns_left == 1) {
-                ghost->current_move += 1; // move on
-                command->turns_left = command->turns;
-            }
-            else command->turns_left -= 1;
+            if (ghost->turns_left == 0) ghost->turns_left = command->turns;
+            if (--ghost->turns_left == 0) ghost->current_move += 1; // move on
             return VALID_MOVE;
         default:
             return INVALID_MOVE; // Invalid direction
@@ -367,14 +402,10 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
     int old_index = ghost->pos_y * board->width + ghost->pos_x;
 
     // locks
-    if (old_index < new_index) {
-        pthread_mutex_lock(&board->board[old_index].lock);
-        pthread_mutex_lock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_lock(&board->board[new_index].lock);
-        pthread_mutex_lock(&board->board[old_index].lock);
-    }
+    uint64_t stripes = CELL_STRIPE(old_index) | CELL_STRIPE(new_index);
+    trace_begin("cell_locks");
+    LOCK_STRIPES(board, stripes);
+    trace_end("cell_locks");
 
     char target_content = board->board[new_index].content;
 
@@ -404,42 +435,31 @@ int move_ghost(board_t* board, int ghost_index, command_t* command) {
 
     // Update board - clear old position (restore what was there)
     board->board[old_index].content = ' '; // Or restore the dot if ghost was on one
+    mark_dirty(board, old_index);
     // Update ghost position
     ghost->pos_x = new_x;
     ghost->pos_y = new_y;
     // Update board - set new position
     board->board[new_index].content = 'M';
+    mark_dirty(board, new_index);
 
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
-    }
+    UNLOCK_STRIPES(board, stripes);
     
     return result;
 
     move_ghost_invalid:
-    if (old_index < new_index) {
-        pthread_mutex_unlock(&board->board[old_index].lock);
-        pthread_mutex_unlock(&board->board[new_index].lock);
-    }
-    else {
-        pthread_mutex_unlock(&board->board[new_index].lock);
-        pthread_mutex_unlock(&board->board[old_index].lock);
-    }
+    UNLOCK_STRIPES(board, stripes);
     return INVALID_MOVE;
 }
 
 void kill_pacman(board_t* board, int pacman_index) {
-    debug("Killing %d pacman\n\n", pacman_index);
+    log_debug("Killing %d pacman\n\n", pacman_index);
     pacman_t* pac = &board->pacmans[pacman_index];
     int index = pac->pos_y * board->width + pac->pos_x;
 
     // Remove pacman from the board
     board->board[index].content = ' ';
+    mark_dirty(board, index);
 
     // Mark pacman as dead
     pac->alive = 0;
@@ -466,63 +486,77 @@ int load_ghost(board_t* board) {
     return 0;
 }
 
-int load_level(board_t *board, char *filename, char* dirname, int points) {
+// Frees what the parser allocated for board, safe on a partly read level
+static void free_level_data(board_t *board) {
+    for (int i = 0; board->pacmans && i < board->n_pacmans; i++) free(board->pacmans[i].moves);
+    for (int i = 0; board->ghosts && i < board->n_ghosts; i++) free(board->ghosts[i].moves);
+    free(board->board);
+    free(board->pacmans);
+    free(board->ghosts);
+    free(board->level_name);
+    board->board = NULL;
+    board->pacmans = NULL;
+    board->ghosts = NULL;
+    board->level_name = NULL;
+}
 
-    if (read_level(board, filename, dirname) < 0) {
-        printf("Failed to load level\n");
+int load_level(board_t *board, char *filename, char* dirname, int points) {
+    trace_begin("load_level");
+    // Only needed until the entities are read, too big for the session stacks
+    level_files_t *files = malloc(sizeof(level_files_t));
+    const char *failed = NULL;
+    if (!files || read_level(board, files, filename, dirname) < 0) failed = "Failed to load level\n";
+    else if (read_pacman(board, files, points) < 0) failed = "Failed to load the pacman\n";
+    else if (read_ghosts(board, files) < 0) failed = "Failed to read ghosts\n";
+    free(files);
+
+    if (failed) {
+        printf("%s", failed);
+        free_level_data(board);
+        trace_end("load_level");
         return -1;
     }
 
-    if (read_pacman(board, points) < 0) {
-        printf("Failed to load the pacman\n");
-    }
-
-    if (read_ghosts(board) < 0) {
-        printf("Failed to read ghosts\n");
-    }
-
     pthread_rwlock_init(&board->state_lock, NULL);
 
-    for (int i = 0; i < board->height * board->width; i++) {
-        pthread_mutex_init(&board->board[i].lock, NULL);
+    // Every page counts as changed until the first checkpoint copies it
+    board->n_pages = (board->height * board->width + BOARD_PAGE_CELLS - 1) / BOARD_PAGE_CELLS;
+    board->dirty_pages = malloc(board->n_pages);
+    memset(board->dirty_pages, 1, board->n_pages);
+
+    for (int i = 0; i < CELL_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&board->cell_locks[i], NULL);
     }
+    board->bytes = board_bytes(board);
 
     //print_board(board);
+    trace_end("load_level");
     return 0;
 }
 
 void unload_level(board_t * board) {
     pthread_rwlock_destroy(&board->state_lock);
-    for (int i = 0; i < board->height * board->width; i++) {
-        pthread_mutex_destroy(&board->board[i].lock);
+    for (int i = 0; i < CELL_LOCK_STRIPES; i++) {
+        pthread_mutex_destroy(&board->cell_locks[i]);
     }
-    free(board->board);
-    free(board->pacmans);
-    free(board->ghosts);
-}
-
-void open_debug_file(char *filename) {
-    debugfile = fopen(filename, "w");
-}
-
-void close_debug_file() {
-    fclose(debugfile);
+    free(board->dirty_pages);
+    free_level_data(board);
 }
 
-void debug(const char * format, ...) {
-    if (debugfile == NULL) return; // Se o ficheiro não estiver aberto, não faz nada
-    
-    va_list args;
-    va_start(args, format);
-    vfprintf(debugfile, format, args);
-    va_end(args);
-
-    fflush(debugfile);
+size_t board_bytes(board_t *board) {
+    size_t bytes = sizeof(board_t);
+    bytes += (size_t)board->width * board->height * sizeof(board_pos_t);
+    bytes += board->n_pacmans * sizeof(pacman_t) + board->n_ghosts * sizeof(ghost_t);
+    for (int i = 0; i < board->n_pacmans; i++) bytes += board->pacmans[i].n_moves * sizeof(command_t);
+    for (int i = 0; i < board->n_ghosts; i++) bytes += board->ghosts[i].n_moves * sizeof(command_t);
+    bytes += board->n_pages;
+    if (board->level_name) bytes += strlen(board->level_name) + 1;
+    return bytes;
 }
 
 void print_board(board_t *board) {
     if (!board || !board->board) {
-        debug("[%d] Board is empty or not initialized.\n", getpid());
+        log_debug("[%d] Board is empty or not initialized.\n", getpid());
         return;
     }
 
@@ -534,16 +568,9 @@ void print_board(board_t *board) {
                        "=== [%d] LEVEL INFO ===\n"
                        "Dimensions: %d x %d\n"
                        "Tempo: %d\n"
-                       "Pacman file: %s\n",
-                       getpid(), board->height, board->width, board->tempo, board->pacman_file);
-
-    offset += snprintf(buffer + offset, sizeof(buffer) - offset,
-                       "Monster files (%d):\n", board->n_ghosts);
-
-    for (int i = 0; i < board->n_ghosts; i++) {
-        offset += snprintf(buffer + offset, sizeof(buffer) - offset,
-                           "  - %s\n", board->ghosts_files[i]);
-    }
+                       "Level: %s\n"
+                       "Monsters: %d\n",
+                       getpid(), board->height, board->width, board->tempo, board->level_name, board->n_ghosts);
 
     offset += snprintf(buffer + offset, sizeof(buffer) - offset, "\n=== BOARD ===\n");
 
@@ -563,5 +590,5 @@ void print_board(board_t *board) {
 
     buffer[offset] = '\0';
 
-    debug("%s", buffer);
+    log_debug("%s", buffer);
 }
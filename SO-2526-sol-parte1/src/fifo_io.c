@@ -0,0 +1,403 @@
+#define _GNU_SOURCE // syscall(), MAP_POPULATE
+#include "fifo_io.h"
+#include "futex.h"
+#include "metrics.h"
+#include "threads.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define RING_ENTRIES 256
+// While sessions send, the ring thread takes their frames every 2 slots of the timer
+// wheel: the ticks that fired in those slots go out in one submission
+#define FIFO_BATCH_NS 2000000ull
+
+enum { OP_SEND = 1, OP_READ, OP_CANCEL, OP_WAKE };
+
+/*The rings as mapped from the kernel. Only the ring thread touches them (no SQPOLL),
+the kernel moves sq_head and cq_tail during io_uring_enter*/
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned queued; // SQEs written since the last io_uring_enter
+    void *sq_map, *cq_map; // the same mapping with IORING_FEAT_SINGLE_MMAP
+    size_t sq_size, cq_size, sqes_size;
+} ring_t;
+
+static fifo_io_mode_t mode = FIFO_IO_BLOCKING;
+static ring_t ring;
+
+// Ops handed to the ring thread (a stack, pushed by any thread)
+static _Atomic(fifo_op_t *) pending;
+// Set while the ring thread sleeps with no batch window open: the next push wakes it
+static atomic_int sleeping;
+static int wake_fd = -1;
+static uint64_t wake_value;
+static fifo_op_t wake_op = { .kind = OP_WAKE };
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+// Futex waits and wakes between the sessions and the ring thread are FIFO syscalls too
+static void wait_while(atomic_uint *word, unsigned value) {
+    while (atomic_load(word) == value) {
+        metrics_inc(METRIC_FIFO_SYSCALLS, 1);
+        futex_wait(word, value, 0);
+    }
+}
+
+static void wake(atomic_uint *word) {
+    metrics_inc(METRIC_FIFO_SYSCALLS, 1);
+    futex_wake(word, 1);
+}
+
+// Makes the ring thread take the pending ops now instead of at the end of its window
+static void kick() {
+    uint64_t one = 1;
+    metrics_inc(METRIC_FIFO_SYSCALLS, 1);
+    if (write(wake_fd, &one, sizeof(one)) < 0) {} // the counter only overflows after 2^64 - 1 kicks
+}
+
+static int ring_setup(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) return -1;
+
+    // NODROP: completions are never lost with many reads armed; RW_CUR_POS and FAST_POLL:
+    // reads and writes at offset -1 that poll the pipe instead of blocking a kernel worker;
+    // EXT_ARG: a timeout on io_uring_enter itself (5.11)
+    unsigned needed = IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS | IORING_FEAT_FAST_POLL | IORING_FEAT_EXT_ARG;
+    if ((p.features & needed) != needed) {
+        close(fd);
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size) sq_size = cq_size;
+        cq_size = sq_size;
+    }
+    size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    unsigned char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    unsigned char *cq = sq;
+    if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    void *sqes = (sq != MAP_FAILED && cq != MAP_FAILED)
+        ? mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES)
+        : MAP_FAILED;
+    if (sqes == MAP_FAILED) {
+        if (cq != MAP_FAILED && cq != sq) munmap(cq, cq_size);
+        if (sq != MAP_FAILED) munmap(sq, sq_size);
+        close(fd);
+        return -1;
+    }
+
+    ring.fd = fd;
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.sq_entries = p.sq_entries;
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring.sqes = sqes;
+    ring.sq_map = sq;
+    ring.cq_map = cq;
+    ring.sq_size = sq_size;
+    ring.cq_size = cq_size;
+    ring.sqes_size = sqes_size;
+    return 0;
+}
+
+// Undoes ring_setup
+static void ring_free() {
+    munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_map != ring.sq_map) munmap(ring.cq_map, ring.cq_size);
+    munmap(ring.sq_map, ring.sq_size);
+    close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+}
+
+// Hands the queued SQEs to the kernel. wait: also sleep until a completion arrives or
+// timeout_ns (0 = no timeout) passes
+static void ring_enter(int wait, uint64_t timeout_ns) {
+    if (ring.queued == 0 && !wait) return;
+    struct __kernel_timespec ts = { .tv_sec = timeout_ns / 1000000000ull, .tv_nsec = timeout_ns % 1000000000ull };
+    struct io_uring_getevents_arg arg = { .ts = (uint64_t)(uintptr_t)&ts };
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    if (wait && timeout_ns) flags |= IORING_ENTER_EXT_ARG;
+
+    metrics_inc(METRIC_FIFO_SYSCALLS, 1);
+    syscall(__NR_io_uring_enter, ring.fd, ring.queued, wait ? 1 : 0, flags,
+            (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL, (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+    // Whatever the result (ETIME, EINTR, EBUSY), what the kernel didn't consume stays queued
+    ring.queued = *ring.sq_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+}
+
+static struct io_uring_sqe *ring_sqe() {
+    unsigned tail = *ring.sq_tail;
+    while (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.sq_entries) ring_enter(0, 0);
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    return sqe;
+}
+
+static void ring_push_sqe() {
+    __atomic_store_n(ring.sq_tail, *ring.sq_tail + 1, __ATOMIC_RELEASE);
+    ring.queued++;
+}
+
+// Queues op in the ring (ring thread)
+static void prepare(fifo_op_t *op) {
+    struct io_uring_sqe *sqe = ring_sqe();
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    sqe->off = (uint64_t)-1; // current position, pipes have none
+    switch (op->kind) {
+        case OP_SEND: {
+            fifo_send_t *s = container_of(op, fifo_send_t, op);
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = s->fd;
+            sqe->addr = (uint64_t)(uintptr_t)s->buf;
+            sqe->len = s->len;
+            break;
+        }
+        case OP_READ: {
+            fifo_reader_t *r = container_of(op, fifo_reader_t, op);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = r->fd;
+            sqe->addr = (uint64_t)(uintptr_t)r->buf;
+            sqe->len = sizeof(r->buf);
+            break;
+        }
+        case OP_CANCEL: {
+            fifo_reader_t *r = container_of(op, fifo_reader_t, cancel);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->off = 0;
+            sqe->addr = (uint64_t)(uintptr_t)&r->op;
+            break;
+        }
+        case OP_WAKE:
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = wake_fd;
+            sqe->addr = (uint64_t)(uintptr_t)&wake_value;
+            sqe->len = sizeof(wake_value);
+            break;
+    }
+    ring_push_sqe();
+}
+
+// Hands op to the ring thread, waking it if it waits in the kernel
+static void submit(fifo_op_t *op) {
+    fifo_op_t *head = atomic_load(&pending);
+    do {
+        op->next = head;
+    } while (!atomic_compare_exchange_weak(&pending, &head, op));
+
+    if (atomic_exchange(&sleeping, 0)) kick();
+}
+
+// Queues everything the sessions handed over, oldest first. Returns how many ops
+static int take_pending() {
+    fifo_op_t *list = atomic_exchange(&pending, NULL), *ordered = NULL;
+    while (list) {
+        fifo_op_t *next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    int n = 0;
+    for (; ordered; ordered = ordered->next, n++) prepare(ordered);
+    return n;
+}
+
+static void send_done(fifo_send_t *s, int res) {
+    if (res > 0 && (size_t)res < s->len) {
+        // Frames bigger than the space left in the pipe go out in pieces
+        metrics_inc(METRIC_BYTES_SENT, res);
+        s->buf += res;
+        s->len -= res;
+        prepare(&s->op);
+        return;
+    }
+    if (res > 0) {
+        metrics_inc(METRIC_FRAMES_SENT, 1);
+        metrics_inc(METRIC_BYTES_SENT, res);
+    }
+    if (atomic_exchange(&s->busy, 0) == 2) wake(&s->busy);
+}
+
+// The cancel and the last read of a stopping reader came back, the owner may free it
+static void reader_finish(fifo_reader_t *r) {
+    if (++r->finished < 2) return;
+    atomic_store(&r->armed, 0);
+    wake(&r->armed);
+}
+
+static void read_done(fifo_reader_t *r, int res) {
+    int stopping = atomic_load(&r->stopping);
+    if (res > 0 && !stopping) {
+        r->on_data(r->arg, r->buf, res);
+        prepare(&r->op);
+        return;
+    }
+    if (!stopping) r->on_data(r->arg, NULL, res);
+    unsigned armed = 1;
+    if (atomic_compare_exchange_strong(&r->armed, &armed, 0)) return;
+    reader_finish(r); // fifo_reader_stop is waiting, its cancel is on the way
+}
+
+static void reap() {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        fifo_op_t *op = (fifo_op_t *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+        switch (op->kind) {
+            case OP_SEND: send_done(container_of(op, fifo_send_t, op), res); break;
+            case OP_READ: read_done(container_of(op, fifo_reader_t, op), res); break;
+            case OP_CANCEL: reader_finish(container_of(op, fifo_reader_t, cancel)); break;
+            case OP_WAKE: prepare(&wake_op); break;
+        }
+    }
+}
+
+static void *ring_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    trace_thread(-1, "fifo io");
+
+    prepare(&wake_op);
+    uint64_t window_end = 0; // 0: no session sent anything lately, sleep until one does
+    while (1) {
+        atomic_store(&sleeping, 0);
+        uint64_t now = monotonic_ns();
+        if (take_pending() > 0) window_end = now + FIFO_BATCH_NS;
+        else if (now >= window_end) window_end = 0;
+
+        if (window_end == 0) {
+            atomic_store(&sleeping, 1);
+            if (atomic_load(&pending)) continue;
+        }
+        // One io_uring_enter submits the batch and waits for a completion (a read, a
+        // kick) or the end of the window
+        trace_begin("ring_enter");
+        ring_enter(1, window_end ? window_end - now : 0);
+        trace_end("ring_enter");
+        reap();
+    }
+    return NULL;
+}
+
+fifo_io_mode_t fifo_io_init(fifo_io_mode_t requested) {
+    if (requested != FIFO_IO_URING) return mode;
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) return mode;
+    if (ring_setup(RING_ENTRIES) != 0) {
+        close(wake_fd);
+        wake_fd = -1;
+        return mode;
+    }
+
+    pthread_t tid;
+    if (spawn_thread(&tid, THREAD_SERVICE, ring_thread, NULL, 1) != 0) {
+        ring_free();
+        close(wake_fd);
+        wake_fd = -1;
+        return mode;
+    }
+    mode = FIFO_IO_URING;
+    return mode;
+}
+
+fifo_io_mode_t fifo_io_mode() {
+    return mode;
+}
+
+void fifo_write(int fd, const void *buf, size_t len) {
+    metrics_inc(METRIC_FIFO_SYSCALLS, 1);
+    ssize_t written = write(fd, buf, len);
+    if (written > 0) {
+        metrics_inc(METRIC_FRAMES_SENT, 1);
+        metrics_inc(METRIC_BYTES_SENT, written);
+    }
+}
+
+void fifo_send(fifo_send_t *s, int fd, const void *buf, size_t len) {
+    if (mode == FIFO_IO_BLOCKING) {
+        fifo_write(fd, buf, len);
+        return;
+    }
+    s->op.kind = OP_SEND;
+    s->fd = fd;
+    s->buf = buf;
+    s->len = len;
+    atomic_store(&s->busy, 1);
+    submit(&s->op);
+}
+
+void fifo_send_wait(fifo_send_t *s) {
+    unsigned busy = 1;
+    if (!atomic_compare_exchange_strong(&s->busy, &busy, 2) && busy != 2) return;
+    kick();
+    wait_while(&s->busy, 2);
+}
+
+int fifo_reader_start(fifo_reader_t *r, int fd, fifo_data_fn on_data, void *arg) {
+    if (mode == FIFO_IO_BLOCKING) return -1;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+
+    r->op.kind = OP_READ;
+    r->cancel.kind = OP_CANCEL;
+    r->fd = fd;
+    r->on_data = on_data;
+    r->arg = arg;
+    r->finished = 0;
+    atomic_store(&r->stopping, 0);
+    atomic_store(&r->armed, 1);
+    submit(&r->op);
+    return 0;
+}
+
+void fifo_reader_stop(fifo_reader_t *r) {
+    atomic_store(&r->stopping, 1);
+    unsigned armed = 1;
+    if (!atomic_compare_exchange_strong(&r->armed, &armed, 2)) return; // the read already hit the end of file
+    // The cancel is queued after the read, which the ring thread re-arms before taking it
+    submit(&r->cancel);
+    kick();
+    wait_while(&r->armed, 2);
+}
+
+ssize_t fifo_read(int fd, void *buf, size_t len) {
+    metrics_inc(METRIC_FIFO_SYSCALLS, 1);
+    return read(fd, buf, len);
+}
@@ -0,0 +1,212 @@
+#include "frame.h"
+#include "protocol.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*Storage of a buffer. A reader may still be copying from storage the writer replaced,
+so replaced storage is kept (linked through prev) instead of freed: it at least doubles
+every time, the old ones add up to less than the current one*/
+typedef struct frame_storage {
+    struct frame_storage *prev;
+    size_t cap;
+    unsigned char data[];
+} frame_storage_t;
+
+typedef struct {
+    atomic_uint seq; // odd while the writer fills the buffer
+    _Atomic(frame_storage_t *) storage;
+    _Atomic size_t len;
+} frame_buffer_t;
+
+typedef struct {
+    frame_buffer_t buffers[2];
+    atomic_int front; // -1: no frame
+    atomic_int watchers;
+} frame_slot_t;
+
+static frame_slot_t *slots;
+static int n_slots;
+
+static void write_begin(atomic_uint *seq) {
+    atomic_fetch_add_explicit(seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void write_end(atomic_uint *seq) {
+    atomic_fetch_add_explicit(seq, 1, memory_order_release);
+}
+
+static unsigned read_begin(atomic_uint *seq) {
+    unsigned s;
+    while ((s = atomic_load_explicit(seq, memory_order_acquire)) & 1);
+    return s;
+}
+
+static int read_retry(atomic_uint *seq, unsigned start) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != start;
+}
+
+int frame_init(int max_slots) {
+    slots = calloc(max_slots, sizeof(frame_slot_t));
+    if (!slots) return -1;
+    n_slots = max_slots;
+    for (int i = 0; i < max_slots; i++) atomic_init(&slots[i].front, -1);
+    return 0;
+}
+
+typedef struct {
+    int x, y, width, height; // on the board
+    int culled; // smaller than the board: sent as OP_CODE_BOARD_VIEW
+} window_t;
+
+static int clamp(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// The part of the board view shows: centred on the pacman, kept inside the board
+static window_t view_window(board_t *board, const frame_view_t *view) {
+    int width = (board->board) ? board->width : 1;
+    int height = (board->board) ? board->height : 1;
+    window_t w = { 0, 0, width, height, 0 };
+    if (!view || !board->board) return w;
+
+    if (view->cols > 0 && view->cols < width) w.width = view->cols;
+    if (view->rows > 0 && view->rows < height) w.height = view->rows;
+    if (w.width == width && w.height == height) return w;
+
+    w.culled = 1;
+    int px = 0, py = 0;
+    if (board->n_pacmans > 0 && board->pacmans) {
+        px = board->pacmans[0].pos_x;
+        py = board->pacmans[0].pos_y;
+    }
+    w.x = clamp(px - w.width / 2, 0, width - w.width);
+    w.y = clamp(py - w.height / 2, 0, height - w.height);
+    return w;
+}
+
+size_t frame_size(board_t *board, const frame_view_t *view) {
+    window_t w = view_window(board, view);
+    return (w.culled ? FRAME_VIEW_HEADER : FRAME_HEADER) + (size_t)w.width * w.height;
+}
+
+size_t frame_encode(board_t *board, int victory, int game_over, const frame_view_t *view, unsigned char *packet) {
+    window_t w = view_window(board, view);
+
+    int32_t metadata[FRAME_METADATA];
+    metadata[0] = (int32_t)w.width;
+    metadata[1] = (int32_t)w.height;
+    metadata[2] = (int32_t)board->tempo;
+    metadata[3] = (int32_t)victory;
+    metadata[4] = (int32_t)game_over;
+    metadata[5] = (int32_t)((board->n_pacmans > 0 && board->pacmans) ? board->pacmans[0].points : 0);
+
+    packet[0] = (unsigned char)(w.culled ? OP_CODE_BOARD_VIEW : OP_CODE_BOARD);
+    memcpy(packet + 1, metadata, sizeof(metadata));
+    size_t header = FRAME_HEADER;
+    if (w.culled) {
+        int32_t view_metadata[FRAME_VIEW_METADATA] = { w.x, w.y, board->width, board->height };
+        memcpy(packet + FRAME_HEADER, view_metadata, sizeof(view_metadata));
+        header = FRAME_VIEW_HEADER;
+    }
+    unsigned char *map = packet + header;
+    int map_size = w.width * w.height;
+
+    if (board->board) {
+        for (int y = 0; y < w.height; y++) {
+            board_pos_t *row = &board->board[(w.y + y) * board->width + w.x];
+            unsigned char *out = map + y * w.width;
+            for (int x = 0; x < w.width; x++) {
+                char content = row[x].content;
+                if (content == ' ') {
+                    if (row[x].has_portal) content = '@';
+                    else if (row[x].has_dot) content = '.';
+                }
+                out[x] = (unsigned char)content;
+            }
+        }
+
+        for (int k = 0; k < board->n_ghosts; k++) {
+            ghost_t *g = &board->ghosts[k];
+            int gx = g->pos_x - w.x, gy = g->pos_y - w.y;
+            if (gx >= 0 && gx < w.width && gy >= 0 && gy < w.height) {
+                if (g->charged) map[gy * w.width + gx] = 'm';
+            }
+        }
+    }
+    else {
+        memset(map, ' ', map_size);
+    }
+    return header + map_size;
+}
+
+int frame_publish(int slot, board_t *board, int victory, int game_over, const frame_view_t *view) {
+    if (!slots || slot < 0 || slot >= n_slots) return -1;
+    frame_slot_t *s = &slots[slot];
+    int back = atomic_load_explicit(&s->front, memory_order_relaxed) == 0 ? 1 : 0;
+    frame_buffer_t *b = &s->buffers[back];
+
+    size_t size = frame_size(board, view);
+    frame_storage_t *storage = atomic_load_explicit(&b->storage, memory_order_relaxed);
+    if (!storage || storage->cap < size) {
+        size_t cap = storage ? storage->cap * 2 : size;
+        if (cap < size) cap = size;
+        frame_storage_t *grown = malloc(sizeof(frame_storage_t) + cap);
+        if (!grown) return -1;
+        grown->prev = storage;
+        grown->cap = cap;
+        storage = grown;
+    }
+
+    write_begin(&b->seq);
+    atomic_store_explicit(&b->storage, storage, memory_order_relaxed);
+    atomic_store_explicit(&b->len, frame_encode(board, victory, game_over, view, storage->data), memory_order_relaxed);
+    write_end(&b->seq);
+    atomic_store_explicit(&s->front, back, memory_order_release);
+    return 0;
+}
+
+const unsigned char *frame_current(int slot, size_t *len) {
+    if (!slots || slot < 0 || slot >= n_slots) return NULL;
+    int front = atomic_load_explicit(&slots[slot].front, memory_order_acquire);
+    if (front < 0) return NULL;
+    frame_buffer_t *b = &slots[slot].buffers[front];
+    *len = atomic_load_explicit(&b->len, memory_order_relaxed);
+    return atomic_load_explicit(&b->storage, memory_order_relaxed)->data;
+}
+
+size_t frame_read(int slot, unsigned char *out, size_t cap) {
+    if (!slots || slot < 0 || slot >= n_slots) return 0;
+    frame_slot_t *s = &slots[slot];
+    size_t len;
+    frame_buffer_t *b;
+    unsigned seq;
+    do {
+        int front = atomic_load_explicit(&s->front, memory_order_acquire);
+        if (front < 0) return 0;
+        b = &s->buffers[front];
+        seq = read_begin(&b->seq);
+        frame_storage_t *storage = atomic_load_explicit(&b->storage, memory_order_relaxed);
+        len = atomic_load_explicit(&b->len, memory_order_relaxed);
+        if (len > storage->cap) len = storage->cap; // torn read, retried below
+        memcpy(out, storage->data, len < cap ? len : cap);
+    } while (read_retry(&b->seq, seq));
+    return len;
+}
+
+void frame_clear(int slot) {
+    if (!slots || slot < 0 || slot >= n_slots) return;
+    atomic_store_explicit(&slots[slot].front, -1, memory_order_release);
+}
+
+void frame_watch(int slot, int delta) {
+    if (!slots || slot < 0 || slot >= n_slots) return;
+    atomic_fetch_add_explicit(&slots[slot].watchers, delta, memory_order_relaxed);
+}
+
+int frame_watchers(int slot) {
+    if (!slots || slot < 0 || slot >= n_slots) return 0;
+    return atomic_load_explicit(&slots[slot].watchers, memory_order_relaxed);
+}
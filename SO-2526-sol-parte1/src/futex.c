@@ -0,0 +1,33 @@
+#define _GNU_SOURCE // syscall()
+#include "futex.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int futex_wait(atomic_uint *word, unsigned expected, uint64_t deadline_ns) {
+    struct timespec ts, *timeout = NULL;
+    if (deadline_ns) {
+        uint64_t now = monotonic_ns();
+        if (now >= deadline_ns) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        uint64_t left = deadline_ns - now;
+        ts.tv_sec = left / 1000000000ull;
+        ts.tv_nsec = left % 1000000000ull;
+        timeout = &ts;
+    }
+    return syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+void futex_wake(atomic_uint *word, int n) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
@@ -1,10 +1,22 @@
 #include "board.h"
 #include "protocol.h" 
+#include "threads.h"
+#include "leaderboard.h"
+#include "metrics.h"
+#include "timer.h"
+#include "loader.h"
+#include "manifest.h"
+#include "snapshot.h"
+#include "replay.h"
+#include "log.h"
+#include "trace.h"
+#include "frame.h"
+#include "fifo_io.h"
+#include "overload.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/types.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <pthread.h>
@@ -23,145 +35,272 @@ typedef struct {
     int notif_fd;
     int game_exit_code;
     char next_command;
-    pthread_mutex_t cmd_lock;
+    unsigned char input_op; // op code whose argument hasn't fully arrived yet
+    unsigned char input_arg[2 * sizeof(int32_t)];
+    int input_len;
+    int input_closed; // the client disconnected
+    frame_view_t view; // the client's viewport, 0 x 0 until it sends one
+    pthread_mutex_t cmd_lock; // next_command, view and the input parser
+    fifo_reader_t reader; // request FIFO read armed in the ring (io_uring backend)
+    fifo_send_t send; // the pacman thread's frame in flight
     volatile int thread_shutdown; 
+    atomic_ulong tick_overruns; // late ticks of every thread of the session
+    uint64_t level_switch_ns; // when the pacman reached a portal, 0 once the next level is shown
+    replay_writer_t *replay; // NULL unless replay logging is on
+    int log_sink; // every thread of the session logs here
+    int slot;
 } session_context_t; // Session context structure
 
 typedef struct {
     board_t *board;
     int ghost_index;
     volatile int *shutdown_ptr;
+    ticker_t *ticker; // owned by the level, so the session can cut the wait short
+    replay_writer_t *replay;
+    int log_sink;
 } ghost_thread_arg_t; // Ghost thread argument structure
 
+typedef struct {
+    board_t *board;
+    pthread_t *ghost_tids;
+    ticker_t *ghost_tickers;
+    volatile int shutdown; // stops the ghosts of this level
+} level_run_t; // A level whose threads are running (or winding down)
+
+static int checkpoint_interval = 0; // pacman ticks between automatic checkpoints, 0 = only on 'G'
+static char *replay_dir = NULL; // sessions write a replay log here when set
+static size_t memory_budget = 0; // bytes a session may use for one level, 0 = no limit
+static char *session_log_prefix = "debug"; // session logs are <prefix>-<slot>.log
+
+void set_checkpoint_interval(int ticks) {
+    checkpoint_interval = ticks;
+}
+
+void set_replay_dir(char *dir) {
+    replay_dir = dir;
+}
+
+void set_memory_budget(size_t bytes) {
+    memory_budget = bytes;
+}
+
+void set_session_log_prefix(char *prefix) {
+    session_log_prefix = prefix;
+}
+
+// Memory the session holds while it plays board: the board, the pacman's checkpoint,
+// the published frames, the level's thread bookkeeping and the stacks of its threads
+static size_t session_bytes(board_t *board) {
+    size_t per_ghost = sizeof(pthread_t) + sizeof(ticker_t) + sizeof(ghost_thread_arg_t) + SESSION_STACK_SIZE;
+    return board->bytes + snapshot_bytes(board) + 2 * frame_size(board, NULL) + sizeof(level_run_t)
+         + board->n_ghosts * per_ghost + (size_t)SESSION_STACK_SIZE // pacman
+         + (fifo_io_mode() == FIFO_IO_BLOCKING ? SESSION_STACK_SIZE : 0); // listener
+}
+
+// Take the board state lock, recording the time spent waiting. Macros, so the lock
+// profiler counts every call site apart
+#define STATE_LOCK_TIMED(board, take) do { \
+    uint64_t lock_start_ = metrics_now_ns(); \
+    trace_begin("state_lock"); \
+    take(&(board)->state_lock); \
+    trace_end("state_lock"); \
+    metrics_observe_ns(HIST_STATE_LOCK_WAIT, metrics_now_ns() - lock_start_); \
+} while (0)
+
+#define state_wrlock(board) STATE_LOCK_TIMED(board, STATE_WRLOCK)
+#define state_rdlock(board) STATE_LOCK_TIMED(board, STATE_RDLOCK)
+
+// Writes one encoded frame to the client
+static void send_frame(int fd, const unsigned char *packet, size_t len) {
+    trace_begin("send_frame");
+    fifo_write(fd, packet, len);
+    trace_end("send_frame");
+}
+
 // Function to send board update to client
-void send_board_update(int fd, board_t *board, int victory, int game_over) {
+void send_board_update(int fd, board_t *board, int victory, int game_over, const frame_view_t *view) {
     if (!board || fd < 0) return;
-    
-    int width = (board->board) ? board->width : 1;
-    int height = (board->board) ? board->height : 1;
-    
-    int32_t metadata[6];
-    metadata[0] = (int32_t)width;
-    metadata[1] = (int32_t)height;
-    metadata[2] = (int32_t)board->tempo;
-    metadata[3] = (int32_t)victory;
-    metadata[4] = (int32_t)game_over;
-    metadata[5] = (int32_t)((board->n_pacmans > 0 && board->pacmans) ? board->pacmans[0].points : 0);
-
-    int header_size = 1 + sizeof(metadata);
-    int map_size = width * height;
-    unsigned char *packet = malloc(header_size + map_size);
+
+    unsigned char *packet = malloc(frame_size(board, view));
     if (!packet) return;
+    send_frame(fd, packet, frame_encode(board, victory, game_over, view, packet));
+    free(packet);
+}
 
-    packet[0] = (unsigned char)OP_CODE_BOARD;
-    memcpy(packet + 1, metadata, sizeof(metadata));
+static frame_view_t session_view(session_context_t *ctx) {
+    pthread_mutex_lock(&ctx->cmd_lock);
+    frame_view_t view = ctx->view;
+    pthread_mutex_unlock(&ctx->cmd_lock);
+    return view;
+}
 
-    if (board->board) {
-        for (int i = 0; i < map_size; i++) {
-            char content = board->board[i].content;
-            if (content == ' ') {
-                if (board->board[i].has_portal) content = '@';
-                else if (board->board[i].has_dot) content = '.';
-            }
-            packet[header_size + i] = (unsigned char)content;
-        }
+// Bytes of argument that follow an op code from the client
+static int input_arg_size(unsigned char op) {
+    if (op == OP_CODE_PLAY) return 1;
+    if (op == OP_CODE_VIEWPORT) return 2 * sizeof(int32_t);
+    return 0;
+}
 
-        for (int k = 0; k < board->n_ghosts; k++) {
-            ghost_t *g = &board->ghosts[k];
-            if (g->pos_x >= 0 && g->pos_x < width && g->pos_y >= 0 && g->pos_y < height) {
-                int idx = g->pos_y * width + g->pos_x;
-                if (g->charged) {
-                    packet[header_size + idx] = 'm';
-                }
+// Applies bytes read from the request FIFO (n <= 0: the FIFO failed). Messages may be
+// split across reads, an op code waiting for its argument is kept in ctx
+static void handle_input(void *arg, const unsigned char *data, ssize_t n) {
+    session_context_t *ctx = (session_context_t*) arg;
+    pthread_mutex_lock(&ctx->cmd_lock);
+    for (ssize_t i = 0; i < n && !ctx->input_closed; i++) {
+        if (ctx->input_op) {
+            ctx->input_arg[ctx->input_len++] = data[i];
+            if (ctx->input_len < input_arg_size(ctx->input_op)) continue;
+            if (ctx->input_op == OP_CODE_PLAY) {
+                ctx->next_command = (char)ctx->input_arg[0];
+            } else {
+                int32_t size[2];
+                memcpy(size, ctx->input_arg, sizeof(size));
+                ctx->view.cols = size[0] > 0 ? size[0] : 0;
+                ctx->view.rows = size[1] > 0 ? size[1] : 0;
             }
+            ctx->input_op = 0;
+            ctx->input_len = 0;
+        } else if (input_arg_size(data[i])) {
+            ctx->input_op = data[i];
+        } else if (data[i] == OP_CODE_DISCONNECT) {
+            ctx->input_closed = 1;
         }
-
-    } else {
-        memset(packet + header_size, ' ', map_size);
     }
-    
-    write(fd, packet, header_size + map_size);
-    free(packet);
+    if (n <= 0) ctx->input_closed = 1;
+    if (ctx->input_closed) ctx->next_command = 'Q';
+    pthread_mutex_unlock(&ctx->cmd_lock);
 }
 
-// Thread to listen for player input commands
+// Thread to listen for player input commands (blocking backend)
 void* input_listener_thread(void *arg) {
     session_context_t *ctx = (session_context_t*) arg;
-    unsigned char op;
-    while (read(ctx->req_fd, &op, 1) > 0) {
-        if (op == OP_CODE_PLAY) {
-            char cmd;
-            if (read(ctx->req_fd, &cmd, 1) > 0) {
-                pthread_mutex_lock(&ctx->cmd_lock);
-                ctx->next_command = cmd;
-                pthread_mutex_unlock(&ctx->cmd_lock);
-            }
-        } else if (op == OP_CODE_DISCONNECT) {
-            pthread_mutex_lock(&ctx->cmd_lock);
-            ctx->next_command = 'Q';
-            pthread_mutex_unlock(&ctx->cmd_lock);
-            break;
-        }
-    }
-    pthread_mutex_lock(&ctx->cmd_lock);
-    if(ctx->next_command != 'Q') {
-        ctx->next_command = 'Q';
-    }
-    pthread_mutex_unlock(&ctx->cmd_lock);
+    log_set_sink(ctx->log_sink);
+    trace_thread(ctx->slot, "input %d", ctx->slot);
+    unsigned char buf[FIFO_READ_BUFFER];
+    ssize_t n;
+    do {
+        n = fifo_read(ctx->req_fd, buf, sizeof(buf));
+        handle_input(ctx, buf, n);
+    } while (n > 0 && !ctx->input_closed);
     return NULL;
 }
 
+
 // Thread to control Pacman movements
 void* pacman_thread(void *arg) {
     session_context_t *ctx = (session_context_t*) arg;
     board_t *board = ctx->board;
     pacman_t* pacman = &board->pacmans[0];
+    log_set_sink(ctx->log_sink);
+    trace_thread(ctx->slot, "pacman %d", ctx->slot);
     int *retval = malloc(sizeof(int));
     *retval = CONTINUE_PLAY;
 
+    ticker_t ticker;
+    ticker_init(&ticker, board->tempo, &ctx->tick_overruns);
+
+    board_snapshot_t checkpoint;
+    snapshot_init(&checkpoint, board);
+
     while (true) {
+        uint64_t tick_start = metrics_now_ns();
+        trace_begin("tick");
         pthread_mutex_lock(&ctx->cmd_lock);
         char cmd = ctx->next_command;
         ctx->next_command = '\0';
+        frame_view_t view = ctx->view;
         pthread_mutex_unlock(&ctx->cmd_lock);
 
-        command_t c_struct = {0};
-        command_t* play = NULL;
+        char next = cmd;
+        if (next == '\0' && pacman->n_moves > 0) next = pacman->moves[pacman->current_move % pacman->n_moves].command;
 
-        if (cmd != '\0') {
-            c_struct.command = cmd;
-            c_struct.turns = 1;
-            play = &c_struct;
-        } else if (pacman->n_moves > 0) {
-            play = &pacman->moves[pacman->current_move % pacman->n_moves];
-        }
-
-        if (play != NULL) {
-            if (play->command == 'Q') { *retval = QUIT_GAME; break; }
+        if (next != '\0') {
+            if (next == 'Q') { *retval = QUIT_GAME; trace_end("tick"); break; }
 
-            pthread_rwlock_wrlock(&board->state_lock);
-            int res = move_pacman(board, 0, play);
-            pthread_rwlock_unlock(&board->state_lock);
+            state_wrlock(board);
+            int res = play_pacman(board, 0, cmd, &checkpoint);
+            replay_record(ctx->replay, REPLAY_PACMAN, cmd, res);
+            STATE_UNLOCK(&board->state_lock);
+            if (res == RESTORED_PACMAN) log_debug("Pacman restored from checkpoint\n");
 
-            if (res == REACHED_PORTAL) { *retval = NEXT_LEVEL; break; }
-            if (res == DEAD_PACMAN) { *retval = LOAD_BACKUP; break; }
+            if (res == REACHED_PORTAL) {
+                ctx->level_switch_ns = metrics_now_ns();
+                *retval = NEXT_LEVEL;
+                trace_end("tick");
+                break;
+            }
+            if (res == DEAD_PACMAN) { *retval = LOAD_BACKUP; trace_end("tick"); break; }
         }
         
-        pthread_rwlock_rdlock(&board->state_lock);
-        if (!ctx->thread_shutdown && pacman->alive) {
-             send_board_update(ctx->notif_fd, board, 0, 0);
+        // Under overload only some ticks are shown, but never the first one of a level
+        int shown_tick = ctx->level_switch_ns || overload_send_frame(ticker.ticks);
+
+        // Only the encoding needs the board, the ghosts can move while the frame is written
+        state_rdlock(board);
+        int show = shown_tick && !ctx->thread_shutdown && pacman->alive;
+        int published = show && frame_publish(ctx->slot, board, 0, 0, &view) == 0;
+        if (show && !published) { // no buffer, send from the board after the frame in flight
+            fifo_send_wait(&ctx->send);
+            send_board_update(ctx->notif_fd, board, 0, 0, &view);
+        }
+        STATE_UNLOCK(&board->state_lock);
+
+        // The frame published two ticks ago is overwritten next: its write must be done
+        size_t frame_len;
+        const unsigned char *frame = published ? frame_current(ctx->slot, &frame_len) : NULL;
+        if (frame) {
+            trace_begin("send_frame");
+            fifo_send_wait(&ctx->send);
+            fifo_send(&ctx->send, ctx->notif_fd, frame, frame_len);
+            trace_end("send_frame");
+        }
+        if (show) {
+            if (ctx->level_switch_ns) {
+                metrics_observe_ns(HIST_LEVEL_SWITCH, metrics_now_ns() - ctx->level_switch_ns);
+                ctx->level_switch_ns = 0;
+            }
         }
-        pthread_rwlock_unlock(&board->state_lock);
 
-        sleep_ms(board->tempo); 
+        if (checkpoint_interval > 0 && (ticker.ticks + 1) % checkpoint_interval == 0) {
+            state_wrlock(board);
+            if (pacman->alive) {
+                snapshot_take(&checkpoint, board);
+                replay_record(ctx->replay, REPLAY_CHECKPOINT, 0, 0);
+            }
+            STATE_UNLOCK(&board->state_lock);
+        }
+
+        trace_end("tick");
+        metrics_inc(METRIC_TICKS, 1);
+        metrics_observe_ns(HIST_TICK_DURATION, metrics_now_ns() - tick_start);
+        ticker_wait(&ticker);
         
-        pthread_rwlock_rdlock(&board->state_lock);
-        if (ctx->thread_shutdown || !pacman->alive) { 
-            pthread_rwlock_unlock(&board->state_lock); 
+        state_rdlock(board);
+        int alive = pacman->alive;
+        if (ctx->thread_shutdown) { 
+            STATE_UNLOCK(&board->state_lock); 
             break; 
         }
-        pthread_rwlock_unlock(&board->state_lock);
+        STATE_UNLOCK(&board->state_lock);
+
+        if (!alive) {
+            // Killed by a ghost
+            state_wrlock(board);
+            int restored = pacman->alive;
+            if (!restored && snapshot_restore(&checkpoint, board) == 0) {
+                leaderboard_update(board->session_slot, pacman->points, pacman->pos_x, pacman->pos_y);
+                replay_record(ctx->replay, REPLAY_RESTORE, 0, 0);
+                restored = 1;
+            }
+            STATE_UNLOCK(&board->state_lock);
+            if (!restored) break;
+            log_debug("Pacman restored from checkpoint\n");
+        }
     }
+    // The session writes to the client next, and may close it
+    fifo_send_wait(&ctx->send);
+    ticker_cancel(&ticker);
+    snapshot_free(&checkpoint);
     return (void*) retval;
 }
 
@@ -170,101 +309,199 @@ void* ghost_thread(void *arg) {
     ghost_thread_arg_t *ghost_arg = (ghost_thread_arg_t*) arg;
     board_t *board = ghost_arg->board;
     int ghost_ind = ghost_arg->ghost_index;
-    ghost_t* ghost = &board->ghosts[ghost_ind];
+    replay_writer_t *replay = ghost_arg->replay;
+    log_set_sink(ghost_arg->log_sink);
+    trace_thread(board->session_slot, "ghost %d.%d", board->session_slot, ghost_ind);
     
     volatile int *shutdown_ptr = ghost_arg->shutdown_ptr;
+
+    ticker_t *ticker = ghost_arg->ticker;
     
     free(ghost_arg);
     while (true) {
-        sleep_ms(board->tempo * (1 + ghost->passo));
-        pthread_rwlock_wrlock(&board->state_lock);
+        ticker_wait(ticker);
+        trace_begin("ghost_tick");
+        // Under overload an unwatched ghost makes the moves of several ticks in one
+        int batch = overload_ghost_batch(board->session_slot);
+        state_wrlock(board);
         
         if (*shutdown_ptr) { 
-            pthread_rwlock_unlock(&board->state_lock); 
+            STATE_UNLOCK(&board->state_lock); 
+            trace_end("ghost_tick");
             break; 
         }
         
-        move_ghost(board, ghost_ind, &ghost->moves[ghost->current_move % ghost->n_moves]);
-        pthread_rwlock_unlock(&board->state_lock);
+        for (int i = 0; i < batch; i++) {
+            int res = play_ghost(board, ghost_ind);
+            replay_record(replay, REPLAY_GHOST, ghost_ind, res);
+        }
+        STATE_UNLOCK(&board->state_lock);
+        trace_end("ghost_tick");
+        metrics_inc(METRIC_GHOST_TICKS, batch);
+        if (batch > 1) {
+            metrics_inc(METRIC_GHOST_WAKEUPS_SAVED, batch - 1);
+            ticker_skip(ticker, batch - 1);
+        }
     }
     return NULL;
 }
 
+// Submits the next level of the manifest to the loader, NULL when there are no more levels
+static level_job_t *preload_next_level(level_manifest_t *manifest, int *next_level) {
+    if (*next_level >= manifest->n_levels) return NULL;
+    return loader_submit(manifest->dir, manifest->levels[(*next_level)++].filename);
+}
+
+// Waits for the ghosts of a level that already stopped and frees its board
+static void finish_level(level_run_t *run) {
+    for (int i = 0; i < run->board->n_ghosts; i++) join_thread(run->ghost_tids[i], THREAD_GHOST, NULL);
+    free(run->ghost_tids);
+    free(run->ghost_tickers);
+    unload_level(run->board);
+    free(run->board);
+    free(run);
+}
+
 // Main function to run a game session
-int run_game_session(int req_fd, int notif_fd, char* level_dir_path, int slot_id, board_t **registry, pthread_mutex_t *registry_lock) {
-    srand((unsigned int)time(NULL));
-    DIR* level_dir = opendir(level_dir_path);
-    if (!level_dir) return -1;
+int run_game_session(int req_fd, int notif_fd, int slot_id, board_t **registry, pthread_mutex_t *registry_lock) {
+    // 'R' moves draw from a per level generator derived from this, so a replay can redo them
+    unsigned int seed = (unsigned int)time(NULL) ^ ((unsigned int)slot_id * 2654435761u);
+    int levels_played = 0;
+    // The session plays the levels as they were when it started
+    level_manifest_t *manifest = manifest_acquire();
+    int next_level = 0;
     
-    open_debug_file("debug.log");
+    // Sessions of a slot share its log, opened by the first one
+    char log_path[MAX_FILENAME];
+    snprintf(log_path, sizeof(log_path), "%s-%d.log", session_log_prefix, slot_id);
+    log_set_sink(log_open_sink(log_path));
+    log_info("Session %d started (seed %u)\n", slot_id, seed);
+    trace_thread(slot_id, "session %d", slot_id);
 
     session_context_t ctx = {
         .req_fd = req_fd, 
         .notif_fd = notif_fd, 
         .next_command = '\0', 
-        .thread_shutdown = 0 
+        .thread_shutdown = 0,
+        .level_switch_ns = 0,
+        .replay = replay_open(replay_dir, seed, slot_id),
+        .log_sink = log_get_sink(),
+        .slot = slot_id,
     };
     
     pthread_mutex_init(&ctx.cmd_lock, NULL);
+    atomic_init(&ctx.tick_overruns, 0);
     int accumulated_points = 0;
     bool session_active = true;
-    board_t game_board;
-    struct dirent* entry;
+
+    // Input only touches ctx, it is read for the whole session: by the ring thread,
+    // or by a listener thread of the session with the blocking backend
+    pthread_t in_tid;
+    int listener = fifo_reader_start(&ctx.reader, req_fd, handle_input, &ctx) != 0;
+    if (listener) spawn_thread(&in_tid, THREAD_LISTENER, input_listener_thread, &ctx, 0);
+
+    level_run_t *previous = NULL; // level whose ghosts are still winding down
+    level_job_t *job = preload_next_level(manifest, &next_level);
     
-    while ((entry = readdir(level_dir)) != NULL && session_active) {
-        if (entry->d_name[0] == '.' || !strstr(entry->d_name, ".lvl")) continue;
-        
-        memset(&game_board, 0, sizeof(board_t));
-        if (load_level(&game_board, entry->d_name, level_dir_path, accumulated_points) != 0) continue;
+    while (job && session_active) {
+        board_t *board = loader_wait(job);
+        if (!board) {
+            job = preload_next_level(manifest, &next_level);
+            continue;
+        }
+        if (board->n_pacmans > 0) board->pacmans[0].points = accumulated_points;
+        board->session_slot = slot_id;
+        board->rng_state = replay_level_seed(seed, levels_played++);
+        replay_level(ctx.replay, board->level_name);
+
+        size_t bytes = session_bytes(board);
+        log_info("Level %s: %zu bytes (board %zu)\n", board->level_name, bytes, board->bytes);
+        if (memory_budget && bytes > memory_budget) {
+            printf("Sessão %d: nível %s excede o orçamento de memória (%zu KB > %zu KB)\n",
+                   slot_id, board->level_name, bytes / 1024, memory_budget / 1024);
+            frame_view_t view = session_view(&ctx);
+            send_board_update(notif_fd, board, 0, 1, &view);
+            unload_level(board);
+            free(board);
+            job = NULL; // consumed by loader_wait
+            session_active = false;
+            break;
+        }
+
+        pacman_t *pac = &board->pacmans[0];
+        leaderboard_set_level(slot_id, board->level_name, board->width, board->height, bytes);
+        leaderboard_update(slot_id, pac->points, pac->pos_x, pac->pos_y);
         
         pthread_mutex_lock(registry_lock);
-        registry[slot_id] = &game_board;
+        registry[slot_id] = board;
         pthread_mutex_unlock(registry_lock);
 
-        ctx.board = &game_board;
+        level_run_t *run = malloc(sizeof(level_run_t));
+        run->board = board;
+        run->shutdown = 0;
+        run->ghost_tids = malloc(board->n_ghosts * sizeof(pthread_t));
+        run->ghost_tickers = calloc(board->n_ghosts, sizeof(ticker_t));
+
+        ctx.board = board;
         ctx.thread_shutdown = 0;
         
-        pthread_t pac_tid, in_tid;
-        pthread_create(&in_tid, NULL, input_listener_thread, &ctx);
-        pthread_create(&pac_tid, NULL, pacman_thread, &ctx);
+        pthread_t pac_tid;
+        spawn_thread(&pac_tid, THREAD_PACMAN, pacman_thread, &ctx, 0);
         
-        pthread_t *g_tids = malloc(game_board.n_ghosts * sizeof(pthread_t));
-        for (int i = 0; i < game_board.n_ghosts; i++) {
+        for (int i = 0; i < board->n_ghosts; i++) {
             ghost_thread_arg_t *a = malloc(sizeof(ghost_thread_arg_t));
-            a->board = &game_board; 
+            a->board = board; 
             a->ghost_index = i;
-            a->shutdown_ptr = &ctx.thread_shutdown; 
+            a->shutdown_ptr = &run->shutdown; 
+            a->ticker = &run->ghost_tickers[i];
+            a->replay = ctx.replay;
+            a->log_sink = ctx.log_sink;
+            ticker_init(a->ticker, board->tempo * (1 + board->ghosts[i].passo), &ctx.tick_overruns);
             
-            pthread_create(&g_tids[i], NULL, ghost_thread, a);
+            spawn_thread(&run->ghost_tids[i], THREAD_GHOST, ghost_thread, a, 0);
+        }
+
+        // The new level is already being played: start building the one after it,
+        // then tear down the old one
+        job = preload_next_level(manifest, &next_level);
+        if (previous) {
+            finish_level(previous);
+            previous = NULL;
         }
         
-        int *rv; pthread_join(pac_tid, (void**)&rv);
+        int *rv; join_thread(pac_tid, THREAD_PACMAN, (void**)&rv);
         int res = *rv; free(rv);
         
-        pthread_rwlock_wrlock(&game_board.state_lock);
+        STATE_WRLOCK(&board->state_lock);
         ctx.thread_shutdown = 1; 
-        pthread_rwlock_unlock(&game_board.state_lock);
-        
-        pthread_cancel(in_tid); pthread_join(in_tid, NULL);
-        for (int i = 0; i < game_board.n_ghosts; i++) pthread_join(g_tids[i], NULL);
-        free(g_tids);
+        run->shutdown = 1;
+        STATE_UNLOCK(&board->state_lock);
+        for (int i = 0; i < board->n_ghosts; i++) ticker_cancel(&run->ghost_tickers[i]);
+        replay_level_end(ctx.replay, res, board);
         
-        if (res == NEXT_LEVEL) accumulated_points = game_board.pacmans[0].points;
+        if (res == NEXT_LEVEL) {
+            // Ghosts are woken up to exit, meanwhile the next board is swapped in
+            accumulated_points = board->pacmans[0].points;
+            previous = run;
+        }
         else { 
-            send_board_update(notif_fd, &game_board, 0, 1); 
+            frame_view_t view = session_view(&ctx);
+            send_board_update(notif_fd, board, 0, 1, &view); 
             session_active = false; 
+            finish_level(run);
         }
-        
-        pthread_mutex_lock(registry_lock);
-        registry[slot_id] = (board_t*)0x1;
-        pthread_mutex_unlock(registry_lock);
-
-        unload_level(&game_board);
     }
+
+    if (previous) finish_level(previous);
+    if (job) loader_discard(job);
+    if (listener) { pthread_cancel(in_tid); join_thread(in_tid, THREAD_LISTENER, NULL); }
+    else fifo_reader_stop(&ctx.reader);
     
     pthread_mutex_lock(registry_lock);
     registry[slot_id] = NULL;
     pthread_mutex_unlock(registry_lock);
+    leaderboard_remove(slot_id);
+    frame_clear(slot_id);
 
     if (session_active) { 
         board_t eb = {0};
@@ -272,12 +509,16 @@ int run_game_session(int req_fd, int notif_fd, char* level_dir_path, int slot_id
         p.points = accumulated_points;
         eb.n_pacmans = 1;
         eb.pacmans = &p;
-        send_board_update(notif_fd, &eb, 1, 0); 
+        send_board_update(notif_fd, &eb, 1, 0, NULL); 
     }
     
+    log_info("Session %d ended with %lu late ticks\n", slot_id, (unsigned long)atomic_load(&ctx.tick_overruns));
     pthread_mutex_destroy(&ctx.cmd_lock);
-    closedir(level_dir);
+    manifest_release(manifest);
+    replay_close(ctx.replay);
 
-    close_debug_file();
+    // The session's lines are on disk by the time the client is gone
+    log_flush();
+    log_set_sink(LOG_MAIN_SINK);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,305 @@
+#include "leaderboard.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*Each slot record and the top-K table are seqlocks: the writer makes the sequence odd,
+writes, and makes it even again; readers retry if the sequence was odd or changed.
+A slot record only has one writer at a time (the thread of its session currently
+holding the board's state_lock), the top-K table is serialized by topk_lock.
+The active sessions outside the table sit in a max-heap by points, also under topk_lock,
+so the one that takes a freed place is its root. Heap entries keep their own copy of the
+points: nothing reads another session's record outside its seqlock*/
+
+typedef struct {
+    atomic_uint seq;
+    atomic_int in_top;
+    int heap_pos; // index in the heap, -1 if not there (topk_lock)
+    int active;
+    int points;
+    int pos_x, pos_y;
+    int width, height;
+    size_t bytes;
+    char level_name[LEADERBOARD_NAME];
+} slot_record_t;
+
+typedef struct {
+    atomic_uint seq;
+    int n;
+    int slots[LEADERBOARD_K];
+    int points[LEADERBOARD_K];
+} topk_t;
+
+static slot_record_t *records;
+static int n_slots;
+static atomic_int active_count;
+
+typedef struct {
+    int slot;
+    int points;
+} heap_entry_t;
+
+static topk_t topk;
+static pthread_mutex_t topk_lock = PTHREAD_MUTEX_INITIALIZER;
+static heap_entry_t *heap; // sessions outside the top-K, best at 0 (topk_lock)
+static int heap_n;
+
+static void write_begin(atomic_uint *seq) {
+    atomic_fetch_add_explicit(seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void write_end(atomic_uint *seq) {
+    atomic_fetch_add_explicit(seq, 1, memory_order_release);
+}
+
+static unsigned read_begin(atomic_uint *seq) {
+    unsigned s;
+    while ((s = atomic_load_explicit(seq, memory_order_acquire)) & 1);
+    return s;
+}
+
+static int read_retry(atomic_uint *seq, unsigned start) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != start;
+}
+
+int leaderboard_init(int max_slots) {
+    records = calloc(max_slots, sizeof(slot_record_t));
+    heap = malloc(max_slots * sizeof(heap_entry_t));
+    if (!records || !heap) {
+        free(records);
+        free(heap);
+        records = NULL;
+        heap = NULL;
+        return -1;
+    }
+    for (int s = 0; s < max_slots; s++) records[s].heap_pos = -1;
+    n_slots = max_slots;
+    return 0;
+}
+
+// Insertion sort of the (tiny) table, best first (topk_lock held, inside write_begin/end)
+static void topk_sort() {
+    for (int i = 1; i < topk.n; i++) {
+        int s = topk.slots[i], p = topk.points[i];
+        int j = i - 1;
+        while (j >= 0 && topk.points[j] < p) {
+            topk.slots[j + 1] = topk.slots[j];
+            topk.points[j + 1] = topk.points[j];
+            j--;
+        }
+        topk.slots[j + 1] = s;
+        topk.points[j + 1] = p;
+    }
+}
+
+// Puts an entry at index j of the heap and records where it went (topk_lock held)
+static void heap_place(heap_entry_t e, int j) {
+    heap[j] = e;
+    records[e.slot].heap_pos = j;
+}
+
+static void heap_sift(int i) {
+    heap_entry_t e = heap[i];
+    while (i > 0 && heap[(i - 1) / 2].points < e.points) {
+        heap_place(heap[(i - 1) / 2], i);
+        i = (i - 1) / 2;
+    }
+    while (2 * i + 1 < heap_n) {
+        int c = 2 * i + 1;
+        if (c + 1 < heap_n && heap[c + 1].points > heap[c].points) c++;
+        if (heap[c].points <= e.points) break;
+        heap_place(heap[c], i);
+        i = c;
+    }
+    heap_place(e, i);
+}
+
+// Adds the slot to the heap or moves it to its new points (topk_lock held)
+static void heap_set(int slot, int points) {
+    int i = records[slot].heap_pos;
+    if (i == -1) i = heap_n++;
+    heap[i] = (heap_entry_t){ .slot = slot, .points = points };
+    heap_sift(i);
+}
+
+static void heap_remove(int slot) {
+    int i = records[slot].heap_pos;
+    if (i == -1) return;
+    records[slot].heap_pos = -1;
+    if (i == --heap_n) return;
+    heap[i] = heap[heap_n];
+    heap_sift(i);
+}
+
+// Puts the slot in the top-K or updates its points, keeping the rest in the heap (topk_lock held)
+static void topk_offer(int slot, int points) {
+    int i;
+    for (i = 0; i < topk.n && topk.slots[i] != slot; i++);
+
+    // Stays outside a full table: the readers do not see it
+    if (i == topk.n && topk.n == LEADERBOARD_K && points <= topk.points[topk.n - 1]) {
+        heap_set(slot, points);
+        return;
+    }
+
+    write_begin(&topk.seq);
+    if (i < topk.n) {
+        topk.points[i] = points;
+        // Points only go down on a checkpoint restore, someone outside may now rank higher
+        if (heap_n > 0 && heap[0].points > points) {
+            heap_entry_t best = heap[0];
+            heap_remove(best.slot);
+            heap_set(slot, points);
+            atomic_store(&records[slot].in_top, 0);
+            topk.slots[i] = best.slot;
+            topk.points[i] = best.points;
+            atomic_store(&records[best.slot].in_top, 1);
+        }
+    }
+    else if (topk.n < LEADERBOARD_K) {
+        heap_remove(slot);
+        topk.slots[topk.n] = slot;
+        topk.points[topk.n] = points;
+        topk.n++;
+        atomic_store(&records[slot].in_top, 1);
+    }
+    else {
+        int worst = topk.slots[topk.n - 1];
+        heap_set(worst, topk.points[topk.n - 1]);
+        atomic_store(&records[worst].in_top, 0);
+        heap_remove(slot);
+        topk.slots[topk.n - 1] = slot;
+        topk.points[topk.n - 1] = points;
+        atomic_store(&records[slot].in_top, 1);
+    }
+    topk_sort();
+    write_end(&topk.seq);
+}
+
+void leaderboard_set_level(int slot, const char *level_name, int width, int height, size_t bytes) {
+    if (!records || slot < 0 || slot >= n_slots) return;
+    slot_record_t *r = &records[slot];
+
+    int joined = !r->active;
+    write_begin(&r->seq);
+    if (joined) {
+        r->active = 1;
+        r->points = 0;
+    }
+    strncpy(r->level_name, level_name, LEADERBOARD_NAME - 1);
+    r->level_name[LEADERBOARD_NAME - 1] = '\0';
+    r->width = width;
+    r->height = height;
+    r->bytes = bytes;
+    write_end(&r->seq);
+
+    if (joined) {
+        atomic_fetch_add(&active_count, 1);
+        pthread_mutex_lock(&topk_lock);
+        topk_offer(slot, 0);
+        pthread_mutex_unlock(&topk_lock);
+    }
+}
+
+void leaderboard_update(int slot, int points, int pos_x, int pos_y) {
+    if (!records || slot < 0 || slot >= n_slots) return;
+    slot_record_t *r = &records[slot];
+    if (!r->active) return;
+
+    int changed = (r->points != points);
+    write_begin(&r->seq);
+    r->points = points;
+    r->pos_x = pos_x;
+    r->pos_y = pos_y;
+    write_end(&r->seq);
+
+    // Fast path: the ranking can not change
+    if (!changed) return;
+
+    pthread_mutex_lock(&topk_lock);
+    topk_offer(slot, points);
+    pthread_mutex_unlock(&topk_lock);
+}
+
+void leaderboard_remove(int slot) {
+    if (!records || slot < 0 || slot >= n_slots) return;
+    slot_record_t *r = &records[slot];
+    if (!r->active) return;
+
+    write_begin(&r->seq);
+    r->active = 0;
+    write_end(&r->seq);
+    atomic_fetch_sub(&active_count, 1);
+
+    pthread_mutex_lock(&topk_lock);
+    if (!atomic_load(&r->in_top)) {
+        heap_remove(slot);
+        pthread_mutex_unlock(&topk_lock);
+        return;
+    }
+    write_begin(&topk.seq);
+    int i;
+    for (i = 0; i < topk.n && topk.slots[i] != slot; i++);
+    if (i < topk.n) {
+        topk.n--;
+        topk.slots[i] = topk.slots[topk.n];
+        topk.points[i] = topk.points[topk.n];
+    }
+    atomic_store(&r->in_top, 0);
+
+    // A place opened up: the best session outside the table takes it
+    if (heap_n > 0) {
+        heap_entry_t best = heap[0];
+        heap_remove(best.slot);
+        topk.slots[topk.n] = best.slot;
+        topk.points[topk.n] = best.points;
+        topk.n++;
+        atomic_store(&records[best.slot].in_top, 1);
+    }
+    topk_sort();
+    write_end(&topk.seq);
+    pthread_mutex_unlock(&topk_lock);
+}
+
+int leaderboard_top(leaderboard_entry_t *out, int k) {
+    if (!records) return 0;
+    if (k > LEADERBOARD_K) k = LEADERBOARD_K;
+
+    int slots[LEADERBOARD_K];
+    int n;
+    unsigned s;
+    do {
+        s = read_begin(&topk.seq);
+        n = (topk.n < k) ? topk.n : k;
+        memcpy(slots, topk.slots, sizeof(int) * n);
+    } while (read_retry(&topk.seq, s));
+
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        slot_record_t *r = &records[slots[i]];
+        leaderboard_entry_t e;
+        int active;
+        do {
+            s = read_begin(&r->seq);
+            active = r->active;
+            e.slot_id = slots[i];
+            e.points = r->points;
+            e.pos_x = r->pos_x;
+            e.pos_y = r->pos_y;
+            e.width = r->width;
+            e.height = r->height;
+            e.bytes = r->bytes;
+            memcpy(e.level_name, r->level_name, LEADERBOARD_NAME);
+        } while (read_retry(&r->seq, s));
+
+        if (active) out[count++] = e;
+    }
+    return count;
+}
+
+int leaderboard_active() {
+    return atomic_load(&active_count);
+}
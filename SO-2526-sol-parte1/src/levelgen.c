@@ -0,0 +1,300 @@
+#include "board.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define DEFAULT_WIDTH 64
+#define DEFAULT_HEIGHT 32
+#define DEFAULT_DENSITY 25 // % of the inner cells that start as walls
+#define DEFAULT_GHOSTS 4
+#define DEFAULT_PASSO 1
+#define DEFAULT_MOVES 64
+#define DEFAULT_TEMPO 10
+#define MAX_RUN 8 // longest straight run in a script
+
+typedef struct {
+    int width, height;
+    int density;
+    int n_ghosts;
+    int passo;
+    int n_moves;
+    int tempo;
+    unsigned int seed;
+} gen_params_t;
+
+typedef struct {
+    int width, height;
+    char *cells; // 'X' wall, 'o' open, '@' portal
+    int *label; // connected component of each open cell, -1 for walls
+    size_t pacman;
+    size_t *ghosts;
+} level_t;
+
+// splitmix64: every level has a stream of its own, so a corpus of N levels starts
+// with the corpus of N - 1
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static size_t random_below(uint64_t *state, size_t n) {
+    return (size_t)(next_random(state) % n);
+}
+
+// Labels the open cells by connected component with a BFS. Returns the number of components
+static int label_components(level_t *lv, size_t *queue) {
+    size_t n = (size_t)lv->width * lv->height;
+    for (size_t i = 0; i < n; i++) lv->label[i] = -1;
+
+    int components = 0;
+    for (size_t start = 0; start < n; start++) {
+        if (lv->cells[start] == 'X' || lv->label[start] != -1) continue;
+
+        size_t head = 0, tail = 0;
+        queue[tail++] = start;
+        lv->label[start] = components;
+        while (head < tail) {
+            size_t c = queue[head++];
+            size_t x = c % lv->width;
+            size_t next[4] = { c - 1, c + 1, c - lv->width, c + lv->width };
+            int valid[4] = { x > 0, x + 1 < (size_t)lv->width, c >= (size_t)lv->width, c + lv->width < n };
+            for (int d = 0; d < 4; d++) {
+                if (!valid[d] || lv->cells[next[d]] == 'X' || lv->label[next[d]] != -1) continue;
+                lv->label[next[d]] = components;
+                queue[tail++] = next[d];
+            }
+        }
+        components++;
+    }
+    return components;
+}
+
+// Joins every component to the one of root by opening walls along an L shaped path from
+// its first cell towards root. A path stops at the first cell of a component joined by an
+// earlier path, and every component it crosses on the way gets joined with it
+static void connect(level_t *lv, size_t root, int components) {
+    int *joined = calloc(components, sizeof(int)); // the path that joined each component
+    joined[lv->label[root]] = -1;
+
+    size_t n = (size_t)lv->width * lv->height;
+    int rx = root % lv->width, ry = root / lv->width;
+    int path = 0;
+    for (size_t c = 0; c < n; c++) {
+        if (lv->label[c] < 0 || joined[lv->label[c]]) continue;
+
+        path++;
+        int x = c % lv->width, y = c / lv->width;
+        while (1) {
+            size_t i = (size_t)y * lv->width + x;
+            if (lv->label[i] < 0) {
+                lv->cells[i] = 'o'; // the wall becomes part of the path
+                lv->label[i] = lv->label[root];
+            }
+            else if (joined[lv->label[i]] == 0) {
+                joined[lv->label[i]] = path;
+            }
+            else if (joined[lv->label[i]] != path) {
+                break;
+            }
+            if (x != rx) x += x < rx ? 1 : -1;
+            else if (y != ry) y += y < ry ? 1 : -1;
+            else break;
+        }
+    }
+    free(joined);
+}
+
+// Walls on the border, the inside walled at random, then made connected. The pacman, the
+// ghosts and the portal get distinct open cells
+static int build_level(level_t *lv, const gen_params_t *p, uint64_t *rng) {
+    size_t n = (size_t)p->width * p->height;
+    lv->width = p->width;
+    lv->height = p->height;
+    lv->cells = malloc(n);
+    lv->label = malloc(n * sizeof(int));
+    lv->ghosts = malloc((p->n_ghosts ? p->n_ghosts : 1) * sizeof(size_t));
+    size_t *scratch = malloc(n * sizeof(size_t));
+    if (!lv->cells || !lv->label || !lv->ghosts || !scratch) {
+        free(scratch);
+        return -1;
+    }
+
+    for (int y = 0; y < p->height; y++) {
+        for (int x = 0; x < p->width; x++) {
+            int border = x == 0 || y == 0 || x == p->width - 1 || y == p->height - 1;
+            int wall = border || (int)random_below(rng, 100) < p->density;
+            lv->cells[(size_t)y * p->width + x] = wall ? 'X' : 'o';
+        }
+    }
+
+    // The pacman starts on an inner cell, opened if needed, and every other open cell
+    // must reach it
+    int px = 1 + (int)random_below(rng, p->width - 2);
+    int py = 1 + (int)random_below(rng, p->height - 2);
+    lv->pacman = (size_t)py * p->width + px;
+    lv->cells[lv->pacman] = 'o';
+
+    int components = label_components(lv, scratch);
+    connect(lv, lv->pacman, components);
+
+    // The other entities are drawn from the open cells, without repeats
+    size_t n_open = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (lv->cells[i] != 'X' && i != lv->pacman) scratch[n_open++] = i;
+    }
+    if (n_open < (size_t)p->n_ghosts + 1) {
+        free(scratch);
+        return -1;
+    }
+    for (int k = 0; k <= p->n_ghosts; k++) {
+        size_t j = k + random_below(rng, n_open - k);
+        size_t cell = scratch[j];
+        scratch[j] = scratch[k];
+        scratch[k] = cell;
+        if (k == p->n_ghosts) lv->cells[cell] = '@';
+        else lv->ghosts[k] = cell;
+    }
+
+    free(scratch);
+    return 0;
+}
+
+static void free_level(level_t *lv) {
+    free(lv->cells);
+    free(lv->label);
+    free(lv->ghosts);
+}
+
+// Straight runs in random directions with a few waits and random moves, so the
+// entities cover ground instead of shaking in place. Ghosts also charge
+static void write_moves(FILE *f, int n_moves, int ghost, uint64_t *rng) {
+    static const char dirs[] = "ADWS";
+    int written = 0;
+    while (written < n_moves) {
+        int roll = (int)random_below(rng, 100);
+        if (roll < 5) {
+            fprintf(f, "T %d\n", 1 + (int)random_below(rng, 4));
+            written++;
+        }
+        else if (roll < 10) {
+            fputs("R\n", f);
+            written++;
+        }
+        else if (ghost && roll < 13) {
+            fputs("C\n", f);
+            written++;
+        }
+        else {
+            char dir = dirs[random_below(rng, 4)];
+            int run = 1 + (int)random_below(rng, MAX_RUN);
+            for (int i = 0; i < run && written < n_moves; i++, written++) fprintf(f, "%c\n", dir);
+        }
+    }
+}
+
+static FILE *open_output(const char *dir, const char *name) {
+    char path[2 * MAX_FILENAME];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f) perror(path);
+    return f;
+}
+
+static int write_entity(const char *dir, const char *name, int x, int y, const gen_params_t *p, int ghost, uint64_t *rng) {
+    FILE *f = open_output(dir, name);
+    if (!f) return -1;
+    fprintf(f, "PASSO %d\nPOS %d %d\n", p->passo, x, y);
+    write_moves(f, p->n_moves, ghost, rng);
+    return fclose(f);
+}
+
+// Writes <index>.lvl, <index>.p and <index>-<ghost>.m into dir
+static int generate(const char *dir, int index, const gen_params_t *p) {
+    uint64_t rng = p->seed ^ ((uint64_t)index * 0xD1B54A32D192ED03ull);
+    level_t lv = {0};
+    if (build_level(&lv, p, &rng) != 0) {
+        free_level(&lv);
+        fprintf(stderr, "Nível %d sem espaço para o portal e %d fantasmas\n", index, p->n_ghosts);
+        return -1;
+    }
+
+    char name[MAX_FILENAME];
+    snprintf(name, sizeof(name), "%d.p", index);
+    int res = write_entity(dir, name, lv.pacman % lv.width, lv.pacman / lv.width, p, 0, &rng);
+    for (int g = 0; g < p->n_ghosts && res == 0; g++) {
+        snprintf(name, sizeof(name), "%d-%d.m", index, g + 1);
+        res = write_entity(dir, name, lv.ghosts[g] % lv.width, lv.ghosts[g] / lv.width, p, 1, &rng);
+    }
+
+    snprintf(name, sizeof(name), "%d.lvl", index);
+    FILE *f = res == 0 ? open_output(dir, name) : NULL;
+    if (f) {
+        fprintf(f, "# levelgen: seed %u, nível %d, densidade %d%%\n", p->seed, index, p->density);
+        fprintf(f, "DIM %d %d\nTEMPO %d\nPAC %d.p\nMON", lv.width, lv.height, p->tempo, index);
+        for (int g = 0; g < p->n_ghosts; g++) fprintf(f, " %d-%d.m", index, g + 1);
+        fputc('\n', f);
+        for (int y = 0; y < lv.height; y++) {
+            fwrite(lv.cells + (size_t)y * lv.width, 1, lv.width, f);
+            fputc('\n', f);
+        }
+        res = fclose(f);
+    }
+    else {
+        res = -1;
+    }
+
+    free_level(&lv);
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    gen_params_t p = {
+        .width = DEFAULT_WIDTH, .height = DEFAULT_HEIGHT, .density = DEFAULT_DENSITY,
+        .n_ghosts = DEFAULT_GHOSTS, .passo = DEFAULT_PASSO, .n_moves = DEFAULT_MOVES,
+        .tempo = DEFAULT_TEMPO, .seed = 1,
+    };
+    int n_levels = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:h:d:g:p:m:t:s:n:")) != -1) {
+        switch (opt) {
+            case 'w': p.width = atoi(optarg); break;
+            case 'h': p.height = atoi(optarg); break;
+            case 'd': p.density = atoi(optarg); break;
+            case 'g': p.n_ghosts = atoi(optarg); break;
+            case 'p': p.passo = atoi(optarg); break;
+            case 'm': p.n_moves = atoi(optarg); break;
+            case 't': p.tempo = atoi(optarg); break;
+            case 's': p.seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'n': n_levels = atoi(optarg); break;
+            default: argc = 0; // print usage
+        }
+    }
+
+    if (argc - optind != 1 || p.width < 3 || p.height < 3 || p.width > MAX_SIDE || p.height > MAX_SIDE ||
+        p.density < 0 || p.density > 100 || p.n_ghosts < 0 || p.n_ghosts > MAX_GHOSTS - 1 ||
+        p.passo < 0 || p.n_moves <= 0 || p.tempo <= 0 || n_levels <= 0) {
+        fprintf(stderr, "Uso: %s [-w largura] [-h altura] [-d %% paredes] [-g fantasmas] [-p passo]\n"
+                        "          [-m movimentos] [-t tempo] [-s seed] [-n níveis] <dir>\n"
+                        "   largura e altura de 3 a %d, até %d fantasmas\n",
+                argv[0], MAX_SIDE, MAX_GHOSTS - 1);
+        return 1;
+    }
+
+    const char *dir = argv[optind];
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("Erro ao criar a diretoria");
+        return 1;
+    }
+
+    for (int l = 1; l <= n_levels; l++) {
+        if (generate(dir, l, &p) != 0) return 1;
+    }
+    printf("%d níveis %dx%d com %d fantasmas em %s (seed %u)\n", n_levels, p.width, p.height, p.n_ghosts, dir, p.seed);
+    return 0;
+}
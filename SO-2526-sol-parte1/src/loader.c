@@ -0,0 +1,88 @@
+#include "loader.h"
+#include "queue.h"
+#include "futex.h"
+#include "threads.h"
+#include "metrics.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+static mpmc_queue_t jobs; // level_job_t pointers
+static int started = 0;
+
+// Builds the board of a job and wakes whoever waits for it
+static void run_job(level_job_t *job) {
+    board_t *board = calloc(1, sizeof(board_t));
+    uint64_t start = metrics_now_ns();
+
+    if (board && load_level(board, job->filename, job->dirname, 0) != 0) {
+        free(board);
+        board = NULL;
+    }
+    if (board) {
+        job->load_ns = metrics_now_ns() - start;
+        metrics_observe_ns(HIST_LEVEL_LOAD, job->load_ns);
+        metrics_inc(METRIC_LEVELS_LOADED, 1);
+    }
+
+    job->board = board;
+    atomic_store(&job->done, 1);
+    futex_wake(&job->done, 1);
+}
+
+static void *loader_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    trace_thread(-1, "loader");
+
+    level_job_t *job;
+    while (1) {
+        if (mpmc_pop(&jobs, &job, -1) == 0) run_job(job);
+    }
+    return NULL;
+}
+
+int loader_start(int n_threads) {
+    if (n_threads <= 0) return 0;
+    if (mpmc_init(&jobs, LOADER_QUEUE, sizeof(level_job_t *)) != 0) return -1;
+
+    for (int i = 0; i < n_threads; i++) {
+        pthread_t tid;
+        if (spawn_thread(&tid, THREAD_LOADER, loader_thread, NULL, 1) != 0) break;
+        started++;
+    }
+    return started > 0 ? 0 : -1;
+}
+
+level_job_t *loader_submit(const char *dirname, const char *filename) {
+    level_job_t *job = calloc(1, sizeof(level_job_t));
+    if (!job) return NULL;
+
+    strncpy(job->dirname, dirname, MAX_FILENAME - 1);
+    strncpy(job->filename, filename, MAX_FILENAME - 1);
+    atomic_init(&job->done, 0);
+
+    // No pool or too many preloads in flight: the caller is between ticks anyway
+    if (!started || mpmc_try_push(&jobs, &job) != 0) run_job(job);
+    return job;
+}
+
+board_t *loader_wait(level_job_t *job) {
+    while (atomic_load(&job->done) == 0) futex_wait(&job->done, 0, 0);
+    board_t *board = job->board;
+    free(job);
+    return board;
+}
+
+void loader_discard(level_job_t *job) {
+    board_t *board = loader_wait(job);
+    if (board) {
+        unload_level(board);
+        free(board);
+    }
+}
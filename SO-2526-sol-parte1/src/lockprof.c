@@ -0,0 +1,166 @@
+#include "lockprof.h"
+
+#ifdef LOCKPROF
+
+#include "metrics.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    void *lock;
+    lockprof_site_t *site;
+    uint64_t acquired_ns;
+} held_t;
+
+static const char *class_names[LOCK_CLASSES] = { "state_read", "state_write", "cell" };
+
+static _Atomic(lockprof_site_t *) sites;
+static atomic_int n_sites;
+
+// Locks the thread holds, in acquisition order (charged ghosts hold a row of cells)
+static _Thread_local held_t held[LOCKPROF_MAX_HELD];
+static _Thread_local int n_held;
+
+static void atomic_max(_Atomic uint64_t *max, uint64_t value) {
+    uint64_t cur = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > cur && !atomic_compare_exchange_weak_explicit(max, &cur, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+static int wait_bucket(uint64_t ns) {
+    int b = 0;
+    for (ns >>= 6; ns && b < LOCKPROF_BUCKETS - 1; ns >>= 1) b++;
+    return b;
+}
+
+static void register_site(lockprof_site_t *site, const char *func) {
+    int expected = 0;
+    if (atomic_load_explicit(&site->registered, memory_order_acquire) ||
+        !atomic_compare_exchange_strong(&site->registered, &expected, 1)) return;
+    site->func = func;
+    site->next = atomic_load(&sites);
+    while (!atomic_compare_exchange_weak(&sites, &site->next, site));
+    atomic_fetch_add(&n_sites, 1);
+}
+
+// Counts one acquisition that waited wait_ns (0 if the lock was free)
+static void acquired(void *lock, lockprof_site_t *site, const char *func, uint64_t start, int contended) {
+    uint64_t now = metrics_now_ns();
+    register_site(site, func);
+    atomic_fetch_add_explicit(&site->acquired, 1, memory_order_relaxed);
+    if (contended) {
+        uint64_t wait = now - start;
+        atomic_fetch_add_explicit(&site->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&site->wait_ns, wait, memory_order_relaxed);
+        atomic_max(&site->wait_max_ns, wait);
+        atomic_fetch_add_explicit(&site->wait_hist[wait_bucket(wait)], 1, memory_order_relaxed);
+    }
+    else {
+        atomic_fetch_add_explicit(&site->wait_hist[0], 1, memory_order_relaxed);
+    }
+
+    if (n_held < LOCKPROF_MAX_HELD) held[n_held++] = (held_t){ .lock = lock, .site = site, .acquired_ns = now };
+}
+
+// The hold time goes to the site that took the lock
+static void released(void *lock) {
+    for (int i = n_held - 1; i >= 0; i--) {
+        if (held[i].lock != lock) continue;
+        uint64_t hold = metrics_now_ns() - held[i].acquired_ns;
+        atomic_fetch_add_explicit(&held[i].site->hold_ns, hold, memory_order_relaxed);
+        atomic_max(&held[i].site->hold_max_ns, hold);
+        memmove(&held[i], &held[i + 1], (n_held - i - 1) * sizeof(held_t));
+        n_held--;
+        return;
+    }
+}
+
+void lockprof_mutex_lock(pthread_mutex_t *lock, lockprof_site_t *site, const char *func) {
+    uint64_t start = metrics_now_ns();
+    int contended = pthread_mutex_trylock(lock) != 0;
+    if (contended) pthread_mutex_lock(lock);
+    acquired(lock, site, func, start, contended);
+}
+
+void lockprof_mutex_unlock(pthread_mutex_t *lock) {
+    released(lock);
+    pthread_mutex_unlock(lock);
+}
+
+void lockprof_rdlock(pthread_rwlock_t *lock, lockprof_site_t *site, const char *func) {
+    uint64_t start = metrics_now_ns();
+    int contended = pthread_rwlock_tryrdlock(lock) != 0;
+    if (contended) pthread_rwlock_rdlock(lock);
+    acquired(lock, site, func, start, contended);
+}
+
+void lockprof_wrlock(pthread_rwlock_t *lock, lockprof_site_t *site, const char *func) {
+    uint64_t start = metrics_now_ns();
+    int contended = pthread_rwlock_trywrlock(lock) != 0;
+    if (contended) pthread_rwlock_wrlock(lock);
+    acquired(lock, site, func, start, contended);
+}
+
+void lockprof_rwunlock(pthread_rwlock_t *lock) {
+    released(lock);
+    pthread_rwlock_unlock(lock);
+}
+
+// Upper bound of the bucket holding quantile q of the waits, in ns
+static uint64_t wait_quantile(lockprof_site_t *site, uint64_t total, double q) {
+    uint64_t target = (uint64_t)(q * total), seen = 0;
+    for (int b = 0; b < LOCKPROF_BUCKETS; b++) {
+        seen += atomic_load_explicit(&site->wait_hist[b], memory_order_relaxed);
+        if (seen > target) return 64ull << b;
+    }
+    return 64ull << (LOCKPROF_BUCKETS - 1);
+}
+
+// Sites with the most time spent waiting first
+static int site_cmp(const void *a, const void *b) {
+    uint64_t x = atomic_load(&(*(lockprof_site_t *const *)a)->wait_ns);
+    uint64_t y = atomic_load(&(*(lockprof_site_t *const *)b)->wait_ns);
+    return (x < y) - (x > y);
+}
+
+void lockprof_report() {
+    int n = atomic_load(&n_sites);
+    lockprof_site_t **list = malloc((n ? n : 1) * sizeof(lockprof_site_t *));
+    if (!list) return;
+    int count = 0;
+    for (lockprof_site_t *s = atomic_load(&sites); s && count < n; s = s->next) list[count++] = s;
+    qsort(list, count, sizeof(lockprof_site_t *), site_cmp);
+
+    uint64_t class_acquired[LOCK_CLASSES] = {0}, class_contended[LOCK_CLASSES] = {0};
+    uint64_t class_wait[LOCK_CLASSES] = {0}, class_hold[LOCK_CLASSES] = {0};
+
+    log_info("Lock profile (all sessions since start), %d sites:\n", count);
+    log_info("  %-12s %-32s %10s %7s %10s %10s %10s %10s %10s\n", "class", "site", "acquired", "cont%",
+             "wait_us", "p99_us", "max_us", "hold_us", "hmax_us");
+    for (int i = 0; i < count; i++) {
+        lockprof_site_t *s = list[i];
+        uint64_t acq = atomic_load(&s->acquired), cont = atomic_load(&s->contended);
+        uint64_t wait = atomic_load(&s->wait_ns), hold = atomic_load(&s->hold_ns);
+        class_acquired[s->cls] += acq;
+        class_contended[s->cls] += cont;
+        class_wait[s->cls] += wait;
+        class_hold[s->cls] += hold;
+
+        char where[64];
+        snprintf(where, sizeof(where), "%s:%d", s->func, s->line);
+        log_info("  %-12s %-32s %10lu %6.2f%% %10.1f %10.1f %10.1f %10.1f %10.1f\n", class_names[s->cls], where,
+                 (unsigned long)acq, acq ? 100.0 * cont / acq : 0.0, wait / 1e3,
+                 wait_quantile(s, acq, 0.99) / 1e3, atomic_load(&s->wait_max_ns) / 1e3,
+                 hold / 1e3, atomic_load(&s->hold_max_ns) / 1e3);
+    }
+
+    for (int c = 0; c < LOCK_CLASSES; c++) {
+        if (!class_acquired[c]) continue;
+        log_info("  %-12s total: %lu acquired, %.2f%% contended, wait %.3f ms, held %.3f ms\n", class_names[c],
+                 (unsigned long)class_acquired[c], 100.0 * class_contended[c] / class_acquired[c],
+                 class_wait[c] / 1e6, class_hold[c] / 1e6);
+    }
+    free(list);
+}
+
+#endif
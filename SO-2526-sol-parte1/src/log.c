@@ -0,0 +1,246 @@
+#include "log.h"
+#include "futex.h"
+#include "threads.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SINK_BUFFER (64 * 1024) // bytes gathered per sink before a write
+#define RECORD_ALIGN 8
+#define SKIP_SINK 0xffff // record that pads the end of the ring, the next one is at offset 0
+
+typedef struct {
+    uint32_t len; // bytes of text after the header
+    uint16_t sink;
+    uint16_t level;
+} record_t;
+
+/*Single producer (the owning thread), single consumer (the writer). head and tail only
+grow, the offset in data is their value modulo LOG_RING_SIZE*/
+typedef struct log_ring {
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    atomic_int in_use; // owned by a live thread, free rings are taken by new threads
+    struct log_ring *next; // rings are never unlinked, only reused
+    _Alignas(RECORD_ALIGN) char data[LOG_RING_SIZE];
+} log_ring_t;
+
+typedef struct {
+    char *path;
+    int fd;
+    size_t used;
+    char *buffer;
+} sink_t;
+
+static _Atomic(log_ring_t *) rings;
+static atomic_int running;
+static atomic_uint kick; // futex word, set when a ring fills past half
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER; // one drain at a time
+static pthread_mutex_t sinks_lock = PTHREAD_MUTEX_INITIALIZER; // opening sinks
+static sink_t sinks[LOG_MAX_SINKS];
+static atomic_int n_sinks;
+static pthread_key_t ring_key;
+
+static _Thread_local log_ring_t *my_ring;
+static _Thread_local int my_sink = LOG_MAIN_SINK;
+
+static size_t record_size(size_t len) {
+    return (sizeof(record_t) + len + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+// Hands the ring of an exiting thread to the next thread that logs
+static void release_ring(void *arg) {
+    log_ring_t *ring = arg;
+    atomic_store_explicit(&ring->in_use, 0, memory_order_release);
+}
+
+static log_ring_t *acquire_ring() {
+    for (log_ring_t *r = atomic_load(&rings); r; r = r->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&r->in_use, &expected, 1)) {
+            pthread_setspecific(ring_key, r);
+            return r;
+        }
+    }
+
+    log_ring_t *r = malloc(sizeof(log_ring_t));
+    if (!r) return NULL;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->in_use, 1);
+    r->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &r->next, r));
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+static void sink_write(sink_t *s) {
+    size_t off = 0;
+    while (off < s->used) {
+        ssize_t n = write(s->fd, s->buffer + off, s->used - off);
+        if (n <= 0) break; // a broken log must not stop the game
+        off += n;
+    }
+    s->used = 0;
+}
+
+static void sink_append(int sink, const char *text, size_t len) {
+    if (sink >= atomic_load(&n_sinks)) sink = LOG_MAIN_SINK;
+    sink_t *s = &sinks[sink];
+    if (s->used + len > SINK_BUFFER) sink_write(s);
+    if (len > SINK_BUFFER) len = SINK_BUFFER;
+    memcpy(s->buffer + s->used, text, len);
+    s->used += len;
+}
+
+// Moves every record out of the rings and writes the sinks (writer_lock held)
+static void drain() {
+    for (log_ring_t *r = atomic_load(&rings); r; r = r->next) {
+        uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        while (tail < head) {
+            record_t rec;
+            size_t off = tail % LOG_RING_SIZE;
+            memcpy(&rec, r->data + off, sizeof(rec));
+            if (rec.sink == SKIP_SINK) {
+                tail += LOG_RING_SIZE - off;
+                continue;
+            }
+            sink_append(rec.sink, r->data + off + sizeof(rec), rec.len);
+            tail += record_size(rec.len);
+        }
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+    }
+
+    int n = atomic_load(&n_sinks);
+    for (int i = 0; i < n; i++) {
+        if (sinks[i].used) sink_write(&sinks[i]);
+    }
+}
+
+static void *writer_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while (1) {
+        futex_wait(&kick, 0, monotonic_ns() + LOG_FLUSH_MS * 1000000ull);
+        atomic_store(&kick, 0);
+        pthread_mutex_lock(&writer_lock);
+        drain();
+        pthread_mutex_unlock(&writer_lock);
+    }
+    return NULL;
+}
+
+int log_open_sink(const char *path) {
+    pthread_mutex_lock(&sinks_lock);
+    int n = atomic_load(&n_sinks);
+    for (int i = 0; i < n; i++) {
+        if (strcmp(sinks[i].path, path) == 0) {
+            pthread_mutex_unlock(&sinks_lock);
+            return i;
+        }
+    }
+
+    int id = -1;
+    if (n < LOG_MAX_SINKS) {
+        sink_t *s = &sinks[n];
+        s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        s->buffer = malloc(SINK_BUFFER);
+        s->path = strdup(path);
+        if (s->fd != -1 && s->buffer && s->path) {
+            s->used = 0;
+            id = n;
+            // Published after the slot is filled, the writer reads n_sinks without the lock
+            atomic_store(&n_sinks, n + 1);
+        }
+        else {
+            if (s->fd != -1) close(s->fd);
+            free(s->buffer);
+            free(s->path);
+        }
+    }
+    pthread_mutex_unlock(&sinks_lock);
+    return id;
+}
+
+int log_init(const char *main_path) {
+    if (pthread_key_create(&ring_key, release_ring) != 0) return -1;
+    if (log_open_sink(main_path) != LOG_MAIN_SINK) return -1;
+
+    pthread_t tid;
+    if (spawn_thread(&tid, THREAD_SERVICE, writer_thread, NULL, 1) != 0) return -1;
+    atomic_store(&running, 1);
+    return 0;
+}
+
+void log_set_sink(int sink) {
+    my_sink = (sink >= 0) ? sink : LOG_MAIN_SINK;
+}
+
+int log_get_sink() {
+    return my_sink;
+}
+
+void log_flush() {
+    if (!atomic_load(&running)) return;
+    pthread_mutex_lock(&writer_lock);
+    drain();
+    pthread_mutex_unlock(&writer_lock);
+}
+
+void log_write(int level, const char *format, ...) {
+    if (!atomic_load_explicit(&running, memory_order_relaxed)) return;
+    if (!my_ring && !(my_ring = acquire_ring())) return;
+    log_ring_t *r = my_ring;
+
+    char line[LOG_MAX_LINE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0) return;
+    if (len >= LOG_MAX_LINE) len = LOG_MAX_LINE - 1;
+
+    size_t size = record_size(len);
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t off = head % LOG_RING_SIZE;
+    size_t pad = (off + size > LOG_RING_SIZE) ? LOG_RING_SIZE - off : 0; // record can not wrap
+
+    if (head + pad + size - tail > LOG_RING_SIZE) {
+        // Full: losing a line is better than blocking a game thread
+        metrics_inc(METRIC_LOG_DROPPED, 1);
+        atomic_store(&kick, 1);
+        futex_wake(&kick, 1);
+        return;
+    }
+
+    if (pad) {
+        record_t skip = { .len = 0, .sink = SKIP_SINK, .level = 0 };
+        memcpy(r->data + off, &skip, sizeof(skip));
+        head += pad;
+        off = 0;
+    }
+    record_t rec = { .len = (uint32_t)len, .sink = (uint16_t)my_sink, .level = (uint16_t)level };
+    memcpy(r->data + off, &rec, sizeof(rec));
+    memcpy(r->data + off + sizeof(rec), line, len);
+    atomic_store_explicit(&r->head, head + size, memory_order_release);
+
+    if (head + size - tail > LOG_RING_SIZE / 2 && atomic_load_explicit(&kick, memory_order_relaxed) == 0) {
+        atomic_store(&kick, 1);
+        futex_wake(&kick, 1);
+    }
+}
@@ -0,0 +1,390 @@
+#include "manifest.h"
+#include "parser.h"
+#include "threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER; // guards the pointer swap
+static level_manifest_t *current;
+static char levels_dir[MAX_FILENAME];
+static uint64_t version;
+
+// Levels left out until a ghost file they name shows up (scanning thread only)
+static level_info_t *waiting;
+static int n_waiting, waiting_capacity;
+
+static int is_level_file(const char *name) {
+    size_t len = strlen(name);
+    return name[0] != '.' && len > 4 && strcmp(name + len - 4, ".lvl") == 0;
+}
+
+static long file_size(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) return -1;
+    return (long)st.st_size;
+}
+
+// Path of a file of the levels directory, -1 if it does not fit
+static int resolve(char *out, const char *name) {
+    int n = snprintf(out, MAX_FILENAME, "%s/%s", levels_dir, name);
+    return (n < 0 || n >= MAX_FILENAME) ? -1 : 0;
+}
+
+// Compares digit runs by value, so "2.lvl" sorts before "10.lvl"
+
+static int natural_cmp(const char *a, const char *b) {
+    while (*a && *b) {
+        if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b)) {
+            while (*a == '0') a++;
+            while (*b == '0') b++;
+            size_t la = 0, lb = 0;
+            while (isdigit((unsigned char)a[la])) la++;
+            while (isdigit((unsigned char)b[lb])) lb++;
+            if (la != lb) return la < lb ? -1 : 1;
+            int c = strncmp(a, b, la);
+            if (c) return c;
+            a += la;
+            b += lb;
+        }
+        else {
+            if (*a != *b) return (unsigned char)*a < (unsigned char)*b ? -1 : 1;
+            a++;
+            b++;
+        }
+    }
+    return (*a != 0) - (*b != 0);
+}
+
+static int level_cmp(const void *a, const void *b) {
+    return natural_cmp(((const level_info_t *)a)->filename, ((const level_info_t *)b)->filename);
+}
+
+// Appends the name of a file the level uses to its deps
+static int add_dep(level_info_t *info, const char *name) {
+    size_t n = strlen(name) + 1;
+    char *bigger = realloc(info->deps, info->deps_len + n);
+    if (!bigger) return -1;
+    memcpy(bigger + info->deps_len, name, n);
+    info->deps = bigger;
+    info->deps_len += n;
+    return 0;
+}
+
+// Reads the header of a level and checks its files. Returns -1 if it cannot be played,
+// 1 if one of its ghost files is missing (info keeps its deps)
+static int scan_level(const char *name, level_info_t *info) {
+    memset(info, 0, sizeof(level_info_t));
+    snprintf(info->filename, sizeof(info->filename), "%s", name);
+
+    char path[2 * MAX_FILENAME];
+    snprintf(path, sizeof(path), "%s/%s", levels_dir, name);
+    info->size = file_size(path);
+    line_reader_t r;
+    if (info->size < 0 || line_reader_open(&r, path) != 0) return -1;
+
+    char *save;
+    char file[MAX_FILENAME];
+    int bad_path = 0, missing = 0;
+    while (line_reader_next(&r) > 0) {
+        char *line = r.line;
+        if (line[0] == '#' || line[0] == '\0') continue;
+
+        char *word = strtok_r(line, " \t\n", &save);
+        if (!word) continue;
+
+        if (strcmp(word, "DIM") == 0) {
+            char *arg1 = strtok_r(NULL, " \t\n", &save);
+            char *arg2 = strtok_r(NULL, " \t\n", &save);
+            if (arg1 && arg2) {
+                info->width = atoi(arg1);
+                info->height = atoi(arg2);
+            }
+        }
+        else if (strcmp(word, "TEMPO") == 0) {
+            char *arg = strtok_r(NULL, " \t\n", &save);
+            if (arg) info->tempo = atoi(arg);
+        }
+        else if (strcmp(word, "PAC") == 0) {
+            // A missing pacman file means a user controlled pacman
+            char *arg = strtok_r(NULL, " \t\n", &save);
+            if (arg && (resolve(file, arg) != 0 || add_dep(info, arg) != 0)) bad_path = 1;
+        }
+        else if (strcmp(word, "MON") == 0) {
+            // The loader fails on a missing ghost file: the level waits for it
+            char *arg;
+            while ((arg = strtok_r(NULL, " \t\n", &save)) != NULL && info->n_ghosts < MAX_GHOSTS - 1) {
+                info->n_ghosts++;
+                if (resolve(file, arg) != 0 || add_dep(info, arg) != 0) bad_path = 1;
+                else if (file_size(file) <= 0) missing = 1;
+            }
+        }
+        else {
+            break;
+        }
+    }
+    line_reader_close(&r);
+
+    if (bad_path || info->width <= 0 || info->height <= 0 || info->width > MAX_SIDE || info->height > MAX_SIDE) {
+        free(info->deps);
+        info->deps = NULL;
+        return -1;
+    }
+    return missing;
+}
+
+static int uses_file(const level_info_t *info, const char *name) {
+    for (const char *d = info->deps; d && d < info->deps + info->deps_len; d += strlen(d) + 1) {
+        if (strcmp(d, name) == 0) return 1;
+    }
+    return 0;
+}
+
+// Copies a level into another snapshot, which owns its own deps
+static int copy_level(level_info_t *dst, const level_info_t *src) {
+    *dst = *src;
+    if (!src->deps) return 0;
+    dst->deps = malloc(src->deps_len);
+    if (!dst->deps) return -1;
+    memcpy(dst->deps, src->deps, src->deps_len);
+    return 0;
+}
+
+static void clear_waiting() {
+    for (int i = 0; i < n_waiting; i++) free(waiting[i].deps);
+    n_waiting = 0;
+}
+
+// Keeps a level that misses a file, taking its deps. Out of memory it is forgotten
+// until the next full scan
+static void add_waiting(level_info_t *info) {
+    if (n_waiting == waiting_capacity) {
+        int capacity = waiting_capacity ? 2 * waiting_capacity : 8;
+        level_info_t *bigger = realloc(waiting, capacity * sizeof(level_info_t));
+        if (!bigger) {
+            free(info->deps);
+            return;
+        }
+        waiting = bigger;
+        waiting_capacity = capacity;
+    }
+    waiting[n_waiting++] = *info;
+}
+
+static void drop_waiting(int i) {
+    free(waiting[i].deps);
+    waiting[i] = waiting[--n_waiting];
+}
+
+// Scans a level into dst, returns 1 if it can be played
+static int scan_into(const char *name, level_info_t *dst) {
+    int res = scan_level(name, dst);
+    if (res == 1) add_waiting(dst);
+    return res == 0;
+}
+
+static void free_manifest(level_manifest_t *m) {
+    for (int i = 0; i < m->n_levels; i++) free(m->levels[i].deps);
+    free(m);
+}
+
+static level_manifest_t *manifest_alloc(int capacity) {
+    level_manifest_t *m = malloc(sizeof(level_manifest_t) + (capacity ? capacity : 1) * sizeof(level_info_t));
+    if (!m) return NULL;
+    atomic_init(&m->refs, 1);
+    snprintf(m->dir, sizeof(m->dir), "%s", levels_dir);
+    m->n_levels = 0;
+    return m;
+}
+
+// Sorts a new snapshot and makes it the current one (only the scanning thread calls this)
+static void publish(level_manifest_t *m) {
+    qsort(m->levels, m->n_levels, sizeof(level_info_t), level_cmp);
+    m->version = ++version;
+
+    pthread_mutex_lock(&current_lock);
+    level_manifest_t *old = current;
+    current = m;
+    pthread_mutex_unlock(&current_lock);
+
+    if (old) manifest_release(old);
+}
+
+// Builds the manifest from scratch
+static int full_scan() {
+    DIR *dir = opendir(levels_dir);
+    if (!dir) return -1;
+
+    clear_waiting();
+    int capacity = 16;
+    level_manifest_t *m = manifest_alloc(capacity);
+    struct dirent *entry;
+    while (m && (entry = readdir(dir)) != NULL) {
+        if (!is_level_file(entry->d_name)) continue;
+        if (m->n_levels == capacity) {
+            capacity *= 2;
+            level_manifest_t *bigger = realloc(m, sizeof(level_manifest_t) + capacity * sizeof(level_info_t));
+            if (!bigger) {
+                free_manifest(m);
+                m = NULL;
+                break;
+            }
+            m = bigger;
+        }
+        if (scan_into(entry->d_name, &m->levels[m->n_levels])) m->n_levels++;
+    }
+    closedir(dir);
+
+    if (!m) return -1;
+    publish(m);
+    return 0;
+}
+
+// Applies a change to one file of the directory on top of the current snapshot
+static void refresh_file(const char *name) {
+    int level = is_level_file(name);
+    int changed = 0;
+    int n_retry = 0;
+    for (int i = 0; i < n_waiting && !level; i++) n_retry += uses_file(&waiting[i], name);
+
+    level_manifest_t *old = manifest_acquire();
+    level_manifest_t *m = manifest_alloc(old->n_levels + 1 + n_retry);
+    if (!m) {
+        manifest_release(old);
+        return;
+    }
+
+    for (int i = 0; i < old->n_levels; i++) {
+        level_info_t *info = &old->levels[i];
+        if (level && strcmp(info->filename, name) == 0) {
+            changed = 1; // rescanned below
+            continue;
+        }
+        if (!level && uses_file(info, name)) {
+            changed = 1;
+            if (scan_into(info->filename, &m->levels[m->n_levels])) m->n_levels++;
+            continue;
+        }
+        if (copy_level(&m->levels[m->n_levels], info) != 0) {
+            // Out of memory: keep the old snapshot, the next change retries
+            manifest_release(old);
+            free_manifest(m);
+            return;
+        }
+        m->n_levels++;
+    }
+    manifest_release(old);
+
+    // Only the levels waiting for this file are read again. Backwards, so the ones
+    // that go back to waiting land past i
+    for (int i = n_waiting - 1; i >= 0 && !level; i--) {
+        if (!uses_file(&waiting[i], name)) continue;
+        char retry[MAX_FILENAME];
+        snprintf(retry, sizeof(retry), "%s", waiting[i].filename);
+        drop_waiting(i);
+        if (scan_into(retry, &m->levels[m->n_levels])) {
+            m->n_levels++;
+            changed = 1;
+        }
+    }
+    if (level) {
+        // Rewritten or removed: forget why it was waiting and read it again
+        for (int i = n_waiting - 1; i >= 0; i--) {
+            if (strcmp(waiting[i].filename, name) == 0) drop_waiting(i);
+        }
+        if (scan_into(name, &m->levels[m->n_levels])) {
+            m->n_levels++;
+            changed = 1;
+        }
+    }
+
+    if (!changed) {
+        free_manifest(m);
+        return;
+    }
+    publish(m);
+    printf("Níveis atualizados (%s): %d disponíveis\n", name, m->n_levels);
+}
+
+static void *watch_thread(void *arg) {
+    int fd = *(int *)arg;
+    free(arg);
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int watching = 1;
+    while (watching) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) continue;
+
+        for (char *p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) full_scan();
+            else if (ev->mask & IN_IGNORED) watching = 0; // directory removed
+            else if (ev->len > 0) refresh_file(ev->name);
+        }
+    }
+
+    close(fd);
+    thread_exited(THREAD_SERVICE);
+    return NULL;
+}
+
+int manifest_load(const char *dir) {
+    snprintf(levels_dir, sizeof(levels_dir), "%s", dir);
+    return full_scan();
+}
+
+int manifest_init(const char *dir) {
+    snprintf(levels_dir, sizeof(levels_dir), "%s", dir);
+
+    // Watch before scanning so nothing changed in between is missed
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd != -1 && inotify_add_watch(fd, levels_dir, WATCH_EVENTS) == -1) {
+        close(fd);
+        fd = -1;
+    }
+
+    if (full_scan() != 0) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    // Without inotify the manifest is static
+    if (fd == -1) return 0;
+    int *arg = malloc(sizeof(int));
+    *arg = fd;
+    pthread_t tid;
+    if (spawn_thread(&tid, THREAD_SERVICE, watch_thread, arg, 1) != 0) {
+        free(arg);
+        close(fd);
+    }
+    return 0;
+}
+
+level_manifest_t *manifest_acquire() {
+    pthread_mutex_lock(&current_lock);
+    level_manifest_t *m = current;
+    atomic_fetch_add(&m->refs, 1);
+    pthread_mutex_unlock(&current_lock);
+    return m;
+}
+
+void manifest_release(level_manifest_t *manifest) {
+    if (atomic_fetch_sub(&manifest->refs, 1) == 1) free_manifest(manifest);
+}
@@ -0,0 +1,319 @@
+#include "metrics.h"
+#include "threads.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_GAUGES 32
+
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+typedef struct metrics_shard {
+    _Alignas(64) atomic_uint_fast64_t counters[METRIC_COUNTERS];
+    histogram_t hist[HIST_HISTOGRAMS];
+    struct metrics_shard *next; // list of every shard ever created
+    struct metrics_shard *next_free; // shards of threads that exited
+} metrics_shard_t;
+
+typedef struct {
+    const char *name;
+    const char *help;
+    metrics_gauge_fn fn;
+} gauge_t;
+
+static const char *counter_names[METRIC_COUNTERS][2] = {
+    [METRIC_TICKS] = {"pacmanist_ticks_total", "Pacman (session) ticks executed"},
+    [METRIC_GHOST_TICKS] = {"pacmanist_ghost_ticks_total", "Ghost ticks executed"},
+    [METRIC_FRAMES_SENT] = {"pacmanist_frames_sent_total", "Board frames written to clients"},
+    [METRIC_BYTES_SENT] = {"pacmanist_frame_bytes_sent_total", "Bytes of board frames written to clients"},
+    [METRIC_LEVELS_LOADED] = {"pacmanist_levels_loaded_total", "Levels loaded by sessions"},
+    [METRIC_TICK_OVERRUNS] = {"pacmanist_tick_overruns_total", "Pacman and ghost ticks that started after their deadline"},
+    [METRIC_VIRTUAL_JUMPS] = {"pacmanist_virtual_clock_jumps_total", "Times the virtual clock skipped to the next deadline"},
+    [METRIC_LOG_DROPPED] = {"pacmanist_log_lines_dropped_total", "Log lines dropped because the thread's log ring was full"},
+    [METRIC_FIFO_SYSCALLS] = {"pacmanist_fifo_syscalls_total", "System calls made for client FIFO reads and frame writes"},
+    [METRIC_OVERLOAD_RAISED] = {"pacmanist_overload_raised_total", "Times the overload controller stepped up a level"},
+    [METRIC_OVERLOAD_LOWERED] = {"pacmanist_overload_lowered_total", "Times the overload controller stepped down a level"},
+    [METRIC_FRAMES_SHED] = {"pacmanist_frames_shed_total", "Frames not sent to clients to lower the frame rate under overload"},
+    [METRIC_GHOST_WAKEUPS_SAVED] = {"pacmanist_ghost_wakeups_saved_total", "Ghost moves coalesced into the wakeup of an earlier move under overload"},
+    [METRIC_ADMISSION_PAUSED_MS] = {"pacmanist_admission_paused_milliseconds_total", "Time new clients were not admitted under overload"},
+};
+
+static const char *hist_names[HIST_HISTOGRAMS][2] = {
+    [HIST_TICK_DURATION] = {"pacmanist_tick_duration_seconds", "Work done in a pacman tick"},
+    [HIST_STATE_LOCK_WAIT] = {"pacmanist_state_lock_wait_seconds", "Time spent waiting for a board state_lock"},
+    [HIST_LEVEL_LOAD] = {"pacmanist_level_load_seconds", "Time to load a level"},
+    [HIST_LEVEL_SWITCH] = {"pacmanist_level_switch_seconds", "Time from reaching a portal to the first frame of the next level"},
+    [HIST_CHECKPOINT] = {"pacmanist_checkpoint_seconds", "Time to checkpoint a level in memory"},
+    [HIST_RESTORE] = {"pacmanist_restore_seconds", "Time to restore a dead pacman from its checkpoint"},
+};
+
+static metrics_shard_t *all_shards;
+static metrics_shard_t *free_shards;
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local metrics_shard_t *local_shard;
+
+static gauge_t gauges[MAX_GAUGES];
+static int n_gauges;
+static pthread_mutex_t gauges_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int exporter_fd = -1;
+
+// Thread exit: the shard keeps its values and is handed to the next new thread
+static void release_shard(void *arg) {
+    metrics_shard_t *shard = arg;
+    pthread_mutex_lock(&shards_lock);
+    shard->next_free = free_shards;
+    free_shards = shard;
+    pthread_mutex_unlock(&shards_lock);
+}
+
+static void create_key() {
+    pthread_key_create(&shard_key, release_shard);
+}
+
+static metrics_shard_t *get_shard() {
+    if (local_shard) return local_shard;
+
+    pthread_once(&shard_key_once, create_key);
+    pthread_mutex_lock(&shards_lock);
+    metrics_shard_t *shard = free_shards;
+    if (shard) {
+        free_shards = shard->next_free;
+    }
+    else {
+        shard = aligned_alloc(64, (sizeof(metrics_shard_t) + 63) & ~(size_t)63);
+        if (!shard) {
+            pthread_mutex_unlock(&shards_lock);
+            return NULL;
+        }
+        memset(shard, 0, sizeof(metrics_shard_t));
+        shard->next = all_shards;
+        all_shards = shard;
+    }
+    pthread_mutex_unlock(&shards_lock);
+
+    pthread_setspecific(shard_key, shard);
+    local_shard = shard;
+    return shard;
+}
+
+// Only the owning thread writes to a shard, so no read-modify-write is needed
+static inline void local_add(atomic_uint_fast64_t *x, uint64_t v) {
+    atomic_store_explicit(x, atomic_load_explicit(x, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+static int bucket_index(uint64_t v) {
+    if (v < HIST_SUB_BUCKETS) return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e > HIST_MAX_EXP) return HIST_BUCKETS - 1;
+    int sub = (int)(v >> (e - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1);
+    return HIST_SUB_BUCKETS + (e - HIST_SUB_BITS) * HIST_SUB_BUCKETS + sub;
+}
+
+// Largest value (ns) that falls in the bucket
+static uint64_t bucket_upper(int idx) {
+    if (idx < HIST_SUB_BUCKETS) return idx;
+    int e = (idx - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS + HIST_SUB_BITS;
+    int sub = (idx - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS;
+    return ((uint64_t)(HIST_SUB_BUCKETS + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+uint64_t metrics_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void metrics_inc(metric_counter_t counter, uint64_t value) {
+    metrics_shard_t *shard = get_shard();
+    if (shard) local_add(&shard->counters[counter], value);
+}
+
+void metrics_observe_ns(metric_hist_t hist, uint64_t ns) {
+    metrics_shard_t *shard = get_shard();
+    if (!shard) return;
+    histogram_t *h = &shard->hist[hist];
+    local_add(&h->buckets[bucket_index(ns)], 1);
+    local_add(&h->sum, ns);
+    local_add(&h->count, 1);
+}
+
+void metrics_register_gauge(const char *name, const char *help, metrics_gauge_fn fn) {
+    pthread_mutex_lock(&gauges_lock);
+    if (n_gauges < MAX_GAUGES) {
+        gauges[n_gauges++] = (gauge_t){ .name = name, .help = help, .fn = fn };
+    }
+    pthread_mutex_unlock(&gauges_lock);
+}
+
+uint64_t metrics_counter(metric_counter_t counter) {
+    uint64_t total = 0;
+    pthread_mutex_lock(&shards_lock);
+    for (metrics_shard_t *s = all_shards; s; s = s->next) {
+        total += atomic_load_explicit(&s->counters[counter], memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shards_lock);
+    return total;
+}
+
+const char *metrics_counter_name(metric_counter_t counter) {
+    return counter_names[counter][0];
+}
+
+// Sums a histogram over every shard
+static void collect_histogram(metric_hist_t hist, uint64_t *buckets, uint64_t *count, uint64_t *sum) {
+    memset(buckets, 0, sizeof(uint64_t) * HIST_BUCKETS);
+    *count = *sum = 0;
+    pthread_mutex_lock(&shards_lock);
+    for (metrics_shard_t *s = all_shards; s; s = s->next) {
+        histogram_t *h = &s->hist[hist];
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            buckets[i] += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        }
+        *count += atomic_load_explicit(&h->count, memory_order_relaxed);
+        *sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shards_lock);
+}
+
+static double quantile_of(uint64_t *buckets, uint64_t count, double q) {
+    if (count == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) return (double)bucket_upper(i);
+    }
+    return (double)bucket_upper(HIST_BUCKETS - 1);
+}
+
+double metrics_quantile_ns(metric_hist_t hist, double q) {
+    uint64_t buckets[HIST_BUCKETS], count, sum;
+    collect_histogram(hist, buckets, &count, &sum);
+    return quantile_of(buckets, count, q);
+}
+
+void metrics_write_prometheus(FILE *f) {
+    for (int c = 0; c < METRIC_COUNTERS; c++) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+                counter_names[c][0], counter_names[c][1], counter_names[c][0],
+                counter_names[c][0], (unsigned long)metrics_counter(c));
+    }
+
+    pthread_mutex_lock(&gauges_lock);
+    for (int g = 0; g < n_gauges; g++) {
+        fprintf(f, "# HELP %s %s\n# TYPE %s gauge\n%s %.9g\n",
+                gauges[g].name, gauges[g].help, gauges[g].name, gauges[g].name, gauges[g].fn());
+    }
+    pthread_mutex_unlock(&gauges_lock);
+
+    uint64_t buckets[HIST_BUCKETS], count, sum;
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (int h = 0; h < HIST_HISTOGRAMS; h++) {
+        const char *name = hist_names[h][0];
+        collect_histogram(h, buckets, &count, &sum);
+
+        // Exported with one bucket per power of two from ~1us, the quantiles use full resolution
+        fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", name, hist_names[h][1], name);
+        uint64_t cumulative = 0;
+        int idx = 0;
+        for (int e = 9; e <= HIST_MAX_EXP; e++) {
+            uint64_t le = (2ull << e) - 1;
+            while (idx < HIST_BUCKETS && bucket_upper(idx) <= le) cumulative += buckets[idx++];
+            fprintf(f, "%s_bucket{le=\"%.9g\"} %lu\n", name, (le + 1) / 1e9, (unsigned long)cumulative);
+        }
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %lu\n", name, (unsigned long)count);
+        fprintf(f, "%s_sum %.9g\n%s_count %lu\n", name, sum / 1e9, name, (unsigned long)count);
+
+        fprintf(f, "# HELP %s_quantile %s (HDR quantiles)\n# TYPE %s_quantile gauge\n", name, hist_names[h][1], name);
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+            fprintf(f, "%s_quantile{quantile=\"%g\"} %.9g\n", name, quantiles[i],
+                    quantile_of(buckets, count, quantiles[i]) / 1e9);
+        }
+    }
+}
+
+static void serve_client(int fd) {
+    // Scrapers that speak HTTP send a request first, plain readers (socat, nc) do not
+    char request[512];
+    int http = 0;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, 100) > 0) {
+        ssize_t n = read(fd, request, sizeof(request) - 1);
+        http = (n >= 3 && strncmp(request, "GET", 3) == 0);
+    }
+
+    char *body = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&body, &len);
+    if (!f) return;
+    metrics_write_prometheus(f);
+    fclose(f);
+
+    if (http) {
+        char header[128];
+        int n = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+        write(fd, header, n);
+    }
+    for (size_t off = 0; off < len;) {
+        ssize_t n = write(fd, body + off, len - off);
+        if (n <= 0) break;
+        off += n;
+    }
+    free(body);
+}
+
+static void *exporter_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while (1) {
+        int client = accept(exporter_fd, NULL, NULL);
+        if (client == -1) continue;
+        serve_client(client);
+        close(client);
+    }
+    return NULL;
+}
+
+int metrics_start_exporter(const char *socket_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, socket_path);
+
+    exporter_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (exporter_fd == -1) return -1;
+
+    unlink(socket_path);
+    if (bind(exporter_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(exporter_fd, 16) == -1) {
+        close(exporter_fd);
+        exporter_fd = -1;
+        return -1;
+    }
+
+    pthread_t tid;
+    if (spawn_thread(&tid, THREAD_SERVICE, exporter_thread, NULL, 1) != 0) {
+        close(exporter_fd);
+        unlink(socket_path);
+        exporter_fd = -1;
+        return -1;
+    }
+    return 0;
+}
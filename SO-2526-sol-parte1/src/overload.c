@@ -0,0 +1,117 @@
+#include "overload.h"
+#include "metrics.h"
+#include "threads.h"
+#include "futex.h"
+#include "frame.h"
+#include "log.h"
+#include <stdatomic.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+static atomic_uint level = OVERLOAD_NONE; // futex word main sleeps on while admission is paused
+static overload_queue_fn queue_depth;
+
+static const char *level_names[OVERLOAD_LEVELS] = {
+    [OVERLOAD_NONE] = "normal",
+    [OVERLOAD_SHED_FRAMES] = "menos frames",
+    [OVERLOAD_COALESCE_GHOSTS] = "fantasmas agrupados",
+    [OVERLOAD_PAUSE_ADMISSION] = "admissão suspensa",
+};
+
+static double gauge_level() {
+    return atomic_load_explicit(&level, memory_order_relaxed);
+}
+
+static void set_level(overload_level_t next) {
+    overload_level_t prev = atomic_exchange(&level, next);
+    if (next == prev) return;
+    metrics_inc(next > prev ? METRIC_OVERLOAD_RAISED : METRIC_OVERLOAD_LOWERED, 1);
+    log_info("Overload level %d -> %d\n", prev, next);
+    // Main may be waiting for admission to resume
+    if (prev == OVERLOAD_PAUSE_ADMISSION) futex_wake(&level, 1);
+}
+
+static void *controller_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    uint64_t last_ticks = metrics_counter(METRIC_TICKS) + metrics_counter(METRIC_GHOST_TICKS);
+    uint64_t last_overruns = metrics_counter(METRIC_TICK_OVERRUNS);
+    int cool = 0;
+    struct timespec period = { OVERLOAD_SAMPLE_MS / 1000, (OVERLOAD_SAMPLE_MS % 1000) * 1000000L };
+    while (1) {
+        nanosleep(&period, NULL);
+        uint64_t ticks = metrics_counter(METRIC_TICKS) + metrics_counter(METRIC_GHOST_TICKS);
+        uint64_t overruns = metrics_counter(METRIC_TICK_OVERRUNS);
+        uint64_t d_ticks = ticks - last_ticks, d_overruns = overruns - last_overruns;
+        last_ticks = ticks;
+        last_overruns = overruns;
+
+        uint64_t late = d_ticks >= OVERLOAD_MIN_TICKS ? d_overruns * 1000 / d_ticks : 0;
+        int waiting = queue_depth && queue_depth() > 0;
+        overload_level_t current = atomic_load(&level);
+
+        if (late >= OVERLOAD_HIGH_PERMILLE || (waiting && late >= OVERLOAD_LOW_PERMILLE)) {
+            cool = 0;
+            if (current + 1 < OVERLOAD_LEVELS) set_level(current + 1);
+        }
+        else if (late < OVERLOAD_LOW_PERMILLE) {
+            if (++cool >= OVERLOAD_COOL_SAMPLES && current > OVERLOAD_NONE) {
+                cool = 0;
+                set_level(current - 1);
+            }
+        }
+        else {
+            cool = 0; // in between: hold
+        }
+    }
+    return NULL;
+}
+
+int overload_start(int enabled, overload_queue_fn queue) {
+    metrics_register_gauge("pacmanist_overload_level", "Overload control level: 0 normal, 1 fewer frames, 2 ghosts coalesced, 3 admission paused", gauge_level);
+    if (!enabled) return 0;
+    queue_depth = queue;
+    pthread_t tid;
+    return spawn_thread(&tid, THREAD_SERVICE, controller_thread, NULL, 1);
+}
+
+overload_level_t overload_level() {
+    return atomic_load_explicit(&level, memory_order_relaxed);
+}
+
+const char *overload_level_name(overload_level_t l) {
+    return l < OVERLOAD_LEVELS ? level_names[l] : "?";
+}
+
+int overload_send_frame(uint64_t tick) {
+    if (overload_level() < OVERLOAD_SHED_FRAMES || tick % OVERLOAD_FRAME_STRIDE == 0) return 1;
+    metrics_inc(METRIC_FRAMES_SHED, 1);
+    return 0;
+}
+
+int overload_ghost_batch(int slot) {
+    if (overload_level() < OVERLOAD_COALESCE_GHOSTS || frame_watchers(slot) > 0) return 1;
+    return OVERLOAD_GHOST_BATCH;
+}
+
+int overload_admission_wait() {
+    unsigned current = atomic_load(&level);
+    if (current < OVERLOAD_PAUSE_ADMISSION) return 0;
+
+    uint64_t start = metrics_now_ns();
+    int res = 0;
+    while ((current = atomic_load(&level)) >= OVERLOAD_PAUSE_ADMISSION) {
+        if (futex_wait(&level, current, 0) == -1 && errno == EINTR) {
+            res = -1;
+            break;
+        }
+    }
+    metrics_inc(METRIC_ADMISSION_PAUSED_MS, (metrics_now_ns() - start) / 1000000);
+    return res;
+}
@@ -4,71 +4,83 @@
 #include <unistd.h>
 #include "parser.h"
 #include "board.h"
+#include "log.h"
 #include <fcntl.h>
 
-int read_level(board_t* board, char* filename, char* dirname) {
+// Whether line is a header entry named word. Checked before tokenizing, so the first
+// line after the header (a grid row, a "T n" move) reaches its parser untouched
+static int header_word(const char *line, const char *word) {
+    size_t n = strlen(word);
+    return strncmp(line, word, n) == 0 && (line[n] == ' ' || line[n] == '\t' || line[n] == '\0');
+}
+
+int read_level(board_t* board, level_files_t* files, char* filename, char* dirname) {
 
     char fullname[MAX_FILENAME];
-    strcpy(fullname, dirname);
-    strcat(fullname, "/");
-    strcat(fullname, filename);
+    snprintf(fullname, sizeof(fullname), "%s/%s", dirname, filename);
 
-    int fd = open(fullname, O_RDONLY);
-    if (fd == -1) {
-        debug("Error opening file %s\n", fullname);
+    line_reader_t r;
+    if (line_reader_open(&r, fullname) != 0) {
+        log_error("Error opening file %s\n", fullname);
         return -1;
     }
     
-    char command[MAX_COMMAND_LENGTH];
+    char *save; // strtok_r: levels are parsed by several threads at once
 
     // Pacman is optional
-    board->pacman_file[0] = '\0';
+    files->pacman_file[0] = '\0';
     board->n_pacmans = 1;
 
-    strcpy(board->level_name, filename);
-    *strrchr(board->level_name, '.') = '\0';
+    char *dot = strrchr(filename, '.');
+    board->level_name = strndup(filename, dot ? (size_t)(dot - filename) : strlen(filename));
+    if (!board->level_name) {
+        line_reader_close(&r);
+        return -1;
+    }
 
     int read;
-    while ((read = read_line(fd, command)) > 0) {
+    while ((read = line_reader_next(&r)) > 0) {
+        char *line = r.line;
 
         // comment
-        if (command[0] == '#' || command[0] == '\0') continue;
+        if (line[0] == '#' || line[0] == '\0') continue;
 
-        char *word = strtok(command, " \t\n");
-        if (!word) continue;  // skip empty line
-
-        if (strcmp(word, "DIM") == 0) {
-            char *arg1 = strtok(NULL, " \t\n");
-            char *arg2 = strtok(NULL, " \t\n");
+        if (header_word(line, "DIM")) {
+            strtok_r(line, " \t", &save);
+            char *arg1 = strtok_r(NULL, " \t\n", &save);
+            char *arg2 = strtok_r(NULL, " \t\n", &save);
             if (arg1 && arg2) {
                 board->width = atoi(arg1);
                 board->height = atoi(arg2);
-                debug("DIM = %d x %d\n", board->width, board->height);
+                log_debug("DIM = %d x %d\n", board->width, board->height);
             }
         }
 
-        else if (strcmp(word, "TEMPO") == 0) {
-            char *arg = strtok(NULL, " \t\n");
+        else if (header_word(line, "TEMPO")) {
+            strtok_r(line, " \t", &save);
+            char *arg = strtok_r(NULL, " \t\n", &save);
             if (arg) {
                 board->tempo = atoi(arg);
-                debug("TEMPO = %d\n", board->tempo);
+                log_debug("TEMPO = %d\n", board->tempo);
             }
         }
 
-        else if (strcmp(word, "PAC") == 0) {
-            char *arg = strtok(NULL, " \t\n");
+        else if (header_word(line, "PAC")) {
+            strtok_r(line, " \t", &save);
+            char *arg = strtok_r(NULL, " \t\n", &save);
             if (arg) {
-                snprintf(board->pacman_file, sizeof(board->pacman_file), "%s/%s", dirname, arg);
-                debug("PAC = %s\n", board->pacman_file);
+                snprintf(files->pacman_file, sizeof(files->pacman_file), "%s/%s", dirname, arg);
+                log_debug("PAC = %s\n", files->pacman_file);
             }
         }
 
-        else if (strcmp(word, "MON") == 0) {
+        else if (header_word(line, "MON")) {
+            strtok_r(line, " \t", &save);
             char *arg;
             int i = 0;
-            while ((arg = strtok(NULL, " \t\n")) != NULL) {
-                snprintf(board->ghosts_files[i], sizeof(board->ghosts_files[0]), "%s/%s", dirname, arg);
-                debug("MON file: %s\n", board->ghosts_files[i]);
+            while ((arg = strtok_r(NULL, " \t\n", &save)) != NULL) {
+                snprintf(files->ghosts_files[i], sizeof(files->ghosts_files[0]), "%s/%s", dirname, arg);
+                log_debug("MON file: %s\n", files->ghosts_files[i]);
                 i+= 1;
                 if (i == MAX_GHOSTS-1) break;
             }
@@ -80,28 +92,44 @@ int read_level(board_t* board, char* filename, char* dirname) {
         }
     }
 
-    if (!board->width || !board->height) {
-        debug("Missing dimensions in level file\n");
-        close(fd);
+    if (board->width <= 0 || board->height <= 0) {
+        log_error("Missing dimensions in level file\n");
+        line_reader_close(&r);
+        return -1;
+    }
+    if (board->width > MAX_SIDE || board->height > MAX_SIDE) {
+        log_error("Level of %d x %d is over the %d cells limit\n", board->width, board->height, MAX_SIDE);
+        line_reader_close(&r);
         return -1;
     }
     
     // the end of the file contains the grid
-    board->board = calloc(board->width * board->height, sizeof(board_pos_t));
+    board->board = calloc((size_t)board->width * board->height, sizeof(board_pos_t));
     board->pacmans = calloc(board->n_pacmans, sizeof(pacman_t));
-    board->ghosts = calloc(board->n_ghosts, sizeof(ghost_t));
+    board->ghosts = calloc(board->n_ghosts ? board->n_ghosts : 1, sizeof(ghost_t));
+    if (!board->board || !board->pacmans || !board->ghosts) {
+        log_error("No memory for a level of %d x %d\n", board->width, board->height);
+        free(board->board);
+        free(board->pacmans);
+        free(board->ghosts);
+        board->board = NULL;
+        board->pacmans = NULL;
+        board->ghosts = NULL;
+        line_reader_close(&r);
+        return -1;
+    }
 
     int row = 0;
-    // command here still holds the previous line
-    while (read > 0) {
-        if (command[0]== '#' || command[0] == '\0') continue;
-        if (row >= board->height) break;
-
-        debug("Line: %s\n", command);
+    // r.line here still holds the first grid row
+    while (read > 0 && row < board->height) {
+        if (r.line[0] == '#' || r.line[0] == '\0') {
+            read = line_reader_next(&r);
+            continue;
+        }
 
         for (int col = 0; col < board -> width; col++){
-            int idx = row * board->width + col;
-            char content = command[col];
+            size_t idx = (size_t)row * board->width + col;
+            char content = (size_t)col < r.line_len ? r.line[col] : '\0'; // short rows end in dots
 
             switch (content) {
                 case 'X': // wall
@@ -119,39 +147,86 @@ int read_level(board_t* board, char* filename, char* dirname) {
         }
 
         row++;
-        read = read_line(fd, command);
+        read = line_reader_next(&r);
     }
+    log_debug("Grid: %d of %d rows\n", row, board->height);
 
+    line_reader_close(&r);
     if (read == -1) {
-      debug("Failed parsing line");
-      close(fd);
+      log_error("Failed parsing line");
       return read;
     }
+    return 0;
+}
+
+// Reads the moves that end a pacman or ghost file, r holding the first line after the
+// header and read its line_reader_next result. Stores a new array sized to the moves
+// (NULL if there are none) in moves and returns their number, or -1
+static int read_moves(line_reader_t *r, int read, command_t **moves, const char *valid) {
+    command_t *list = NULL;
+    int n = 0, cap = 0;
+    while (read > 0) {
+        char *line = r->line;
+        command_t move = {0};
+        if (line[0] == 'T' && line[1] == ' ') {
+            int t = atoi(line+2);
+            if (t > 0) move = (command_t){ .command = 'T', .turns = t };
+        }
+        else if (line[0] != '#' && line[0] != '\0' && strchr(valid, line[0])) {
+            move = (command_t){ .command = line[0], .turns = 1 };
+        }
+
+        if (move.command) {
+            if (n == cap) {
+                cap = cap ? cap * 2 : 16;
+                command_t *bigger = realloc(list, cap * sizeof(command_t));
+                if (!bigger) {
+                    read = -1;
+                    break;
+                }
+                list = bigger;
+            }
+            list[n++] = move;
+        }
+        read = line_reader_next(r);
+    }
 
-    close(fd);
+    if (read == -1) {
+        free(list);
+        return -1;
+    }
+    if (n > 0 && n < cap) {
+        command_t *fit = realloc(list, n * sizeof(command_t));
+        if (fit) list = fit;
+    }
+    *moves = list;
+    return n;
+}
+
+// Places an entity read from a POS line. Returns -1 if it is not on the board
+static int place(board_t *board, int x, int y, char content) {
+    if (x < 0 || x >= board->width || y < 0 || y >= board->height) return -1;
+    board->board[(size_t)y * board->width + x].content = content;
     return 0;
 }
 
-int read_pacman(board_t* board, int points) {
+int read_pacman(board_t* board, level_files_t* files, int points) {
     pacman_t* pacman = &board->pacmans[0];
     pacman->alive = 1;
     pacman->points = points;
     pacman->current_move = 0;
 
-    int fd = -1;
-
-    if (board->pacman_file[0] != '\0') {
-        fd = open(board->pacman_file, O_RDONLY);
-    }
+    line_reader_t r;
+    int opened = files->pacman_file[0] != '\0' && line_reader_open(&r, files->pacman_file) == 0;
 
-    if (fd == -1) {
+    if (!opened) {
         pacman->passo = 0;
         pacman->waiting = 0;
         pacman->n_moves = 0; // user controlled
 
         for (int i = 0; i < board->height; i++) {
             for (int j = 0; j < board->width; j++) {
-                int idx = i * board->width + j;
+                size_t idx = (size_t)i * board->width + j;
                 if (board->board[idx].content == ' ') {
                     pacman->pos_x = j;
                     pacman->pos_y = i;
@@ -165,30 +240,33 @@ int read_pacman(board_t* board, int points) {
     }
 
     int read;
-    char command[MAX_COMMAND_LENGTH];
-    while ((read = read_line(fd, command)) > 0) {
-        if (command[0] == '#' || command[0] == '\0') continue;
-
-        char *word = strtok(command, " \t\n");
-        if (!word) continue;
-
-        if (strcmp(word, "PASSO") == 0) {
-            char *arg = strtok(NULL, " \t\n");
+    char *save;
+    while ((read = line_reader_next(&r)) > 0) {
+        char *line = r.line;
+        if (line[0] == '#' || line[0] == '\0') continue;
+
+        if (header_word(line, "PASSO")) {
+            strtok_r(line, " \t", &save);
+            char *arg = strtok_r(NULL, " \t\n", &save);
             if (arg) {
                 pacman->passo = atoi(arg);
                 pacman->waiting = pacman->passo;
-                debug("Pacman passo: %d\n", pacman->passo);
+                log_debug("Pacman passo: %d\n", pacman->passo);
             }
         }
-        else if (strcmp(word, "POS") == 0) {
-            char *arg1 = strtok(NULL, " \t\n");
-            char *arg2 = strtok(NULL, " \t\n");
+        else if (header_word(line, "POS")) {
+            strtok_r(line, " \t", &save);
+            char *arg1 = strtok_r(NULL, " \t\n", &save);
+            char *arg2 = strtok_r(NULL, " \t\n", &save);
             if (arg1 && arg2) {
                 pacman->pos_x = atoi(arg1);
                 pacman->pos_y = atoi(arg2);
-                int idx = pacman->pos_y * board->width + pacman->pos_x;
-                board->board[idx].content = 'P';
-                debug("Pacman Pos = %d x %d\n", pacman->pos_x, pacman->pos_y);
+                if (place(board, pacman->pos_x, pacman->pos_y, 'P') != 0) {
+                    log_error("Pacman at %d x %d, outside the board\n", pacman->pos_x, pacman->pos_y);
+                    line_reader_close(&r);
+                    return -1;
+                }
+                log_debug("Pacman Pos = %d x %d\n", pacman->pos_x, pacman->pos_y);
             }
         }
         else {
@@ -199,76 +277,72 @@ int read_pacman(board_t* board, int points) {
     // end of the file contains the moves
     pacman->current_move = 0;
     
-    // command here still holds the previous line
-    int move = 0;
-    while (read > 0 && move < MAX_MOVES) {
-        if (command[0]== '#' || command[0] == '\0') continue;
-        if (command[0] == 'A' ||
-            command[0] == 'D' ||
-            command[0] == 'W' ||
-            command[0] == 'S' ||
-            command[0] == 'R' ||
-            command[0] == 'G' ||
-            command[0] == 'Q') {
-                pacman->moves[move].command = command[0];
-                pacman->moves[move].turns = 1;
-                move += 1;
-        }
-        else if (command[0] == 'T' && command[1] == ' ') { 
-            int t = atoi(command+2);
-            if (t > 0) {
-                pacman->moves[move].command = command[0];
-                pacman->moves[move].turns = t;
-                pacman->moves[move].turns_left = t;
-                move += 1;
-            }
-        }
+    // r.line here still holds the first move
+    pacman->n_moves = read_moves(&r, read, &pacman->moves, PACMAN_MOVES);
+    line_reader_close(&r);
 
-        read = read_line(fd, command);
+    if (pacman->n_moves < 0) {
+        log_error("Failed reading line\n");
+        pacman->n_moves = 0;
+        return -1;
     }
-    pacman->n_moves = move;
+    return 0;
+}
 
-    if (read == -1) {
-        debug("Failed reading line\n");
-        close(fd);
-        return -1;
+int read_pacman_script(char *filename, command_t **moves) {
+    line_reader_t r;
+    if (line_reader_open(&r, filename) != 0) return -1;
+
+    // The header is skipped, the start comes from the level
+    int read;
+    while ((read = line_reader_next(&r)) > 0) {
+        if (r.line[0] == '#' || r.line[0] == '\0') continue;
+        if (!header_word(r.line, "PASSO") && !header_word(r.line, "POS")) break;
     }
 
-    close(fd);
-    return 0;
+    int n_moves = read_moves(&r, read, moves, PACMAN_MOVES);
+    line_reader_close(&r);
+    return n_moves;
 }
 
-int read_ghosts(board_t* board) {
+int read_ghosts(board_t* board, level_files_t* files) {
     for (int i = 0; i < board->n_ghosts; i++) {
-        int fd = open(board->ghosts_files[i], O_RDONLY);
         ghost_t* ghost = &board->ghosts[i];
+        line_reader_t r;
+        if (line_reader_open(&r, files->ghosts_files[i]) != 0) {
+            log_error("Error opening file %s\n", files->ghosts_files[i]);
+            return -1;
+        }
 
         int read;
-        char command[MAX_COMMAND_LENGTH];
-        while ((read = read_line(fd, command)) > 0) {
+        char *save;
+        while ((read = line_reader_next(&r)) > 0) {
+            char *line = r.line;
             // comment
-            if (command[0] == '#' || command[0] == '\0') continue;
+            if (line[0] == '#' || line[0] == '\0') continue;
 
-            char *word = strtok(command, " \t\n");
-            if (!word) continue;  // skip empty line
-
-            if (strcmp(word, "PASSO") == 0) {
-                char *arg = strtok(NULL, " \t\n");
+            if (header_word(line, "PASSO")) {
+                strtok_r(line, " \t", &save);
+                char *arg = strtok_r(NULL, " \t\n", &save);
                 if (arg) {
                     ghost->passo = atoi(arg);
                     ghost->waiting = ghost->passo;
-                    debug("Ghost passo: %d\n", ghost->passo);
+                    log_debug("Ghost passo: %d\n", ghost->passo);
                 }
             }
-            else if (strcmp(word, "POS") == 0) {
-                char *arg1 = strtok(NULL, " \t\n");
-                char *arg2 = strtok(NULL, " \t\n");
+            else if (header_word(line, "POS")) {
+                strtok_r(line, " \t", &save);
+                char *arg1 = strtok_r(NULL, " \t\n", &save);
+                char *arg2 = strtok_r(NULL, " \t\n", &save);
                 if (arg1 && arg2) {
                     ghost->pos_x = atoi(arg1);
                     ghost->pos_y = atoi(arg2);
-                    int idx = ghost->pos_y * board->width + ghost->pos_x;
-                    board->board[idx].content = 'M';
-                    debug("Ghost Pos = %d x %d\n", ghost->pos_x, ghost->pos_y);
+                    if (place(board, ghost->pos_x, ghost->pos_y, 'M') != 0) {
+                        log_error("Ghost %d at %d x %d, outside the board\n", i, ghost->pos_x, ghost->pos_y);
+                        line_reader_close(&r);
+                        return -1;
+                    }
+                    log_debug("Ghost Pos = %d x %d\n", ghost->pos_x, ghost->pos_y);
                 }
             }
             else {
@@ -279,58 +353,74 @@ int read_ghosts(board_t* board) {
         // end of the file contains the moves
         ghost->current_move = 0;
 
-        // command here still holds the previous line
-        int move = 0;
-        while (read > 0 && move < MAX_MOVES) {
-            if (command[0]== '#' || command[0] == '\0') continue;
-            if (command[0] == 'A' ||
-                command[0] == 'D' ||
-                command[0] == 'W' ||
-                command[0] == 'S' ||
-                command[0] == 'R' ||
-                command[0] == 'C') {
-                    ghost->moves[move].command = command[0];
-                    ghost->moves[move].turns = 1; 
-                    move += 1;
-            }
-            else if (command[0] == 'T' && command[1] == ' ') {
-                int t = atoi(command+2);
-                if (t > 0) {
-                    ghost->moves[move].command = command[0];
-                    ghost->moves[move].turns = t;
-                    ghost->moves[move].turns_left = t;
-                    move += 1;
-                }
-            }
-            read = read_line(fd, command);
-        }
-        ghost->n_moves = move;
+        // r.line here still holds the first move
+        ghost->n_moves = read_moves(&r, read, &ghost->moves, GHOST_MOVES);
+        line_reader_close(&r);
 
-        if (read == -1) {
-            debug("Failed reading line\n");
-            close(fd);
+        if (ghost->n_moves < 0) {
+            log_error("Failed reading line\n");
+            ghost->n_moves = 0;
             return -1;
         }
-        close(fd);
     }
 
     return 0;
 }
 
-int read_line(int fd, char *buf) {
-    int i = 0;
-    char c;
-    ssize_t n;
+int line_reader_open(line_reader_t *r, const char *path) {
+    r->fd = open(path, O_RDONLY);
+    if (r->fd == -1) return -1;
+    r->line = NULL;
+    r->line_len = r->line_cap = 0;
+    r->pos = r->len = 0;
+    return 0;
+}
 
-    while ((n = read(fd, &c, 1)) == 1) {
-        if (c == '\r') continue;
-        if (c == '\n') break;
-        buf[i++] = c;
-        if (i == MAX_COMMAND_LENGTH - 1) break;
+// Appends n bytes to the current line, keeping it NUL terminated
+static int line_append(line_reader_t *r, const char *data, size_t n) {
+    if (r->line_len + n + 1 > r->line_cap) {
+        size_t cap = r->line_cap ? r->line_cap : 128;
+        while (cap < r->line_len + n + 1) cap *= 2;
+        char *bigger = realloc(r->line, cap);
+        if (!bigger) return -1;
+        r->line = bigger;
+        r->line_cap = cap;
     }
+    memcpy(r->line + r->line_len, data, n);
+    r->line_len += n;
+    r->line[r->line_len] = '\0';
+    return 0;
+}
+
+int line_reader_next(line_reader_t *r) {
+    r->line_len = 0;
+    if (line_append(r, "", 0) != 0) return -1;
+    int got = 0; // any byte of this line, an empty last line doesn't count
+
+    while (1) {
+        if (r->pos == r->len) {
+            ssize_t n = read(r->fd, r->buf, sizeof(r->buf));
+            if (n < 0) return -1;
+            if (n == 0) return got;
+            r->pos = 0;
+            r->len = n;
+        }
+
+        char *start = r->buf + r->pos;
+        char *newline = memchr(start, '\n', r->len - r->pos);
+        size_t n = newline ? (size_t)(newline - start) : r->len - r->pos;
+        if (line_append(r, start, n) != 0) return -1;
+        r->pos += n + (newline ? 1 : 0);
+        got = 1;
+        if (newline) break;
+    }
+
+    if (r->line_len > 0 && r->line[r->line_len - 1] == '\r') r->line[--r->line_len] = '\0';
+    return 1;
+}
 
-    buf[i] = '\0';
-    if (n == -1) return -1;
-    if (n == 0 && i == 0) return 0;
-    return i;                         
+void line_reader_close(line_reader_t *r) {
+    close(r->fd);
+    free(r->line);
+    r->line = NULL;
 }
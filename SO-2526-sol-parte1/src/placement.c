@@ -0,0 +1,96 @@
+#define _GNU_SOURCE // cpu_set_t, pthread_setaffinity_np()
+#include "placement.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    cpu_set_t cpus;
+    int first, last; // lowest and highest CPU, for the report
+    int sessions;
+} cpu_group_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static cpu_group_t *groups;
+static int n_groups;
+static cpu_set_t session_cpus; // every group, where idle workers run
+
+int placement_init(int group_size) {
+    if (group_size <= 0) return 0;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return -1;
+    int cpus[CPU_SETSIZE], n = 0;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &allowed)) cpus[n++] = c;
+    }
+    if (n == 0) return -1;
+
+    // The first CPU is kept for admission unless it is the only one
+    cpu_set_t admission;
+    CPU_ZERO(&admission);
+    CPU_SET(cpus[0], &admission);
+    int first = (n > 1) ? 1 : 0;
+
+    n_groups = (n - first + group_size - 1) / group_size;
+    groups = calloc(n_groups, sizeof(cpu_group_t));
+    if (!groups) return -1;
+    CPU_ZERO(&session_cpus);
+    for (int i = first; i < n; i++) {
+        cpu_group_t *g = &groups[(i - first) / group_size];
+        if (CPU_COUNT(&g->cpus) == 0) g->first = cpus[i];
+        CPU_SET(cpus[i], &g->cpus);
+        CPU_SET(cpus[i], &session_cpus);
+        g->last = cpus[i];
+    }
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(admission), &admission) != 0) {
+        free(groups);
+        groups = NULL;
+        n_groups = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int placement_acquire() {
+    if (!groups) return -1;
+    pthread_mutex_lock(&lock);
+    int best = 0;
+    for (int g = 1; g < n_groups; g++) {
+        if (groups[g].sessions < groups[best].sessions) best = g;
+    }
+    groups[best].sessions++;
+    pthread_mutex_unlock(&lock);
+
+    // A failed pin only costs locality, the session still runs
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &groups[best].cpus);
+    return best;
+}
+
+void placement_release(int group) {
+    if (!groups || group < 0 || group >= n_groups) return;
+    pthread_mutex_lock(&lock);
+    groups[group].sessions--;
+    pthread_mutex_unlock(&lock);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &session_cpus);
+}
+
+int placement_groups() {
+    return n_groups;
+}
+
+int placement_sessions(int group) {
+    pthread_mutex_lock(&lock);
+    int n = groups[group].sessions;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+void placement_describe(int group, char *buf, size_t size) {
+    cpu_group_t *g = &groups[group];
+    if (g->first == g->last) snprintf(buf, size, "%d", g->first);
+    else if (CPU_COUNT(&g->cpus) == g->last - g->first + 1) snprintf(buf, size, "%d-%d", g->first, g->last);
+    else snprintf(buf, size, "%d..%d (%d CPUs)", g->first, g->last, CPU_COUNT(&g->cpus));
+}
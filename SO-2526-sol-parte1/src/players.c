@@ -0,0 +1,86 @@
+#include "players.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// FNV-1a over the (possibly not terminated) key
+static uint32_t hash_key(const char *key) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < PLAYER_KEY_LENGTH && key[i] != '\0'; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static player_bucket_t *bucket_for(player_set_t *set, const char *key) {
+    return &set->buckets[hash_key(key) & (set->n_buckets - 1)];
+}
+
+int player_set_init(player_set_t *set, size_t expected_players) {
+    // Keep the load factor at or below 0.5
+    size_t n = 16;
+    while (n < expected_players * 2) n <<= 1;
+
+    set->buckets = calloc(n, sizeof(player_bucket_t));
+    if (!set->buckets) return -1;
+    set->n_buckets = n;
+
+    for (size_t i = 0; i < n; i++) {
+        pthread_mutex_init(&set->buckets[i].lock, NULL);
+    }
+    return 0;
+}
+
+void player_set_destroy(player_set_t *set) {
+    for (size_t i = 0; i < set->n_buckets; i++) {
+        player_node_t *node = set->buckets[i].head;
+        while (node) {
+            player_node_t *next = node->next;
+            free(node);
+            node = next;
+        }
+        pthread_mutex_destroy(&set->buckets[i].lock);
+    }
+    free(set->buckets);
+    set->buckets = NULL;
+}
+
+int player_set_insert(player_set_t *set, const char *key) {
+    player_bucket_t *b = bucket_for(set, key);
+
+    // Allocate outside the lock
+    player_node_t *node = malloc(sizeof(player_node_t));
+    if (!node) return -1;
+    strncpy(node->key, key, PLAYER_KEY_LENGTH);
+
+    pthread_mutex_lock(&b->lock);
+    for (player_node_t *it = b->head; it; it = it->next) {
+        if (strncmp(it->key, key, PLAYER_KEY_LENGTH) == 0) {
+            pthread_mutex_unlock(&b->lock);
+            free(node);
+            return -1;
+        }
+    }
+    node->next = b->head;
+    b->head = node;
+    pthread_mutex_unlock(&b->lock);
+    return 0;
+}
+
+void player_set_remove(player_set_t *set, const char *key) {
+    player_bucket_t *b = bucket_for(set, key);
+    player_node_t *found = NULL;
+
+    pthread_mutex_lock(&b->lock);
+    for (player_node_t **it = &b->head; *it; it = &(*it)->next) {
+        if (strncmp((*it)->key, key, PLAYER_KEY_LENGTH) == 0) {
+            found = *it;
+            *it = found->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+
+    free(found);
+}
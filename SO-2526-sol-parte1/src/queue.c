@@ -0,0 +1,173 @@
+#include "queue.h"
+#include "futex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+enum {
+    STAT_PUSHES, STAT_POPS,
+    STAT_PUSH_WAIT, STAT_PUSH_WAIT_MAX,
+    STAT_POP_WAIT, STAT_POP_WAIT_MAX,
+    STAT_RESIDENCE, STAT_RESIDENCE_MAX,
+};
+
+static void stat_add(mpmc_queue_t *q, int total, int max, uint64_t value) {
+    atomic_fetch_add_explicit(&q->stats[total], value, memory_order_relaxed);
+    uint64_t cur = atomic_load_explicit(&q->stats[max], memory_order_relaxed);
+    while (value > cur &&
+           !atomic_compare_exchange_weak_explicit(&q->stats[max], &cur, value,
+                                                  memory_order_relaxed, memory_order_relaxed));
+}
+
+int mpmc_init(mpmc_queue_t *q, size_t capacity, size_t elem_size) {
+    if (capacity < 2 || elem_size == 0) return -1;
+
+    q->capacity = capacity;
+    q->elem_size = elem_size;
+    q->cells = malloc(sizeof(mpmc_cell_t) * capacity);
+    q->data = malloc(elem_size * capacity);
+    if (!q->cells || !q->data) {
+        free(q->cells);
+        free(q->data);
+        return -1;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&q->cells[i].seq, i);
+    }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->items_seq, 0);
+    atomic_init(&q->pop_waiters, 0);
+    atomic_init(&q->space_seq, 0);
+    atomic_init(&q->push_waiters, 0);
+    for (int i = 0; i < 8; i++) {
+        atomic_init(&q->stats[i], 0);
+    }
+    return 0;
+}
+
+void mpmc_destroy(mpmc_queue_t *q) {
+    free(q->cells);
+    free(q->data);
+    q->cells = NULL;
+    q->data = NULL;
+}
+
+int mpmc_try_push(mpmc_queue_t *q, const void *elem) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    mpmc_cell_t *cell;
+
+    while (1) {
+        cell = &q->cells[pos % q->capacity];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0) {
+            return -1; // full
+        }
+        else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+
+    memcpy(q->data + (pos % q->capacity) * q->elem_size, elem, q->elem_size);
+    cell->enqueued_ns = monotonic_ns();
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&q->stats[STAT_PUSHES], 1, memory_order_relaxed);
+    atomic_fetch_add(&q->items_seq, 1);
+    if (atomic_load(&q->pop_waiters) > 0) futex_wake(&q->items_seq, 1);
+    return 0;
+}
+
+int mpmc_try_pop(mpmc_queue_t *q, void *elem) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    mpmc_cell_t *cell;
+
+    while (1) {
+        cell = &q->cells[pos % q->capacity];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0) {
+            return -1; // empty
+        }
+        else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+
+    memcpy(elem, q->data + (pos % q->capacity) * q->elem_size, q->elem_size);
+    uint64_t residence = monotonic_ns() - cell->enqueued_ns;
+    atomic_store_explicit(&cell->seq, pos + q->capacity, memory_order_release);
+
+    atomic_fetch_add_explicit(&q->stats[STAT_POPS], 1, memory_order_relaxed);
+    stat_add(q, STAT_RESIDENCE, STAT_RESIDENCE_MAX, residence);
+    atomic_fetch_add(&q->space_seq, 1);
+    if (atomic_load(&q->push_waiters) > 0) futex_wake(&q->space_seq, 1);
+    return 0;
+}
+
+/*Shared slow path of mpmc_push and mpmc_pop: announce ourselves as a waiter on the
+futex word and sleep until the other side bumps it*/
+static int wait_for(mpmc_queue_t *q, int pushing, void *elem, int timeout_ms) {
+    atomic_uint *word = pushing ? &q->space_seq : &q->items_seq;
+    atomic_uint *waiters = pushing ? &q->push_waiters : &q->pop_waiters;
+    uint64_t start = monotonic_ns();
+    uint64_t deadline = (timeout_ms >= 0) ? start + (uint64_t)timeout_ms * 1000000ull : 0;
+    int ret = 0;
+
+    while (1) {
+        unsigned seen = atomic_load(word);
+        if ((pushing ? mpmc_try_push(q, elem) : mpmc_try_pop(q, elem)) == 0) break;
+
+        atomic_fetch_add(waiters, 1);
+        int r = futex_wait(word, seen, deadline);
+        int err = errno;
+        atomic_fetch_sub(waiters, 1);
+
+        if (r == -1 && (err == EINTR || err == ETIMEDOUT)) {
+            errno = err;
+            ret = -1;
+            break;
+        }
+    }
+
+    if (pushing) stat_add(q, STAT_PUSH_WAIT, STAT_PUSH_WAIT_MAX, monotonic_ns() - start);
+    else stat_add(q, STAT_POP_WAIT, STAT_POP_WAIT_MAX, monotonic_ns() - start);
+    return ret;
+}
+
+int mpmc_push(mpmc_queue_t *q, const void *elem, int timeout_ms) {
+    if (mpmc_try_push(q, elem) == 0) return 0;
+    return wait_for(q, 1, (void *)elem, timeout_ms);
+}
+
+int mpmc_pop(mpmc_queue_t *q, void *elem, int timeout_ms) {
+    if (mpmc_try_pop(q, elem) == 0) return 0;
+    return wait_for(q, 0, elem, timeout_ms);
+}
+
+size_t mpmc_size(mpmc_queue_t *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    return (head > tail) ? head - tail : 0;
+}
+
+void mpmc_get_stats(mpmc_queue_t *q, mpmc_stats_t *stats) {
+    uint64_t *out = (uint64_t *)stats;
+    for (int i = 0; i < 8; i++) {
+        out[i] = atomic_load_explicit(&q->stats[i], memory_order_relaxed);
+    }
+}
@@ -0,0 +1,158 @@
+#include "queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*Stress check of the MPMC queue (make check). Producers and consumers hammer a tiny
+queue so both sides park on the futex all the time. Fails if a blocking call waits
+OP_TIMEOUT_MS (a wakeup was lost), if an item is lost or seen twice, or if a consumer
+sees the items of a producer out of order*/
+
+#define DEFAULT_ITEMS 200000 // per producer
+#define OP_TIMEOUT_MS 5000 // a handoff takes microseconds, this long means nobody woke us
+#define RUN_TIMEOUT_S 120 // SIGALRM kills a run that hangs outside the queue
+#define STOP UINT32_MAX // producer of the item that stops a consumer
+
+typedef struct {
+    uint32_t producer;
+    uint32_t seq;
+} item_t;
+
+typedef struct {
+    int producers, consumers;
+    size_t capacity;
+} config_t;
+
+static const config_t configs[] = {
+    { 1, 1, 2 },
+    { 4, 4, 2 },
+    { 8, 2, 16 },
+    { 2, 8, 4 },
+    { 8, 8, 64 },
+};
+
+static mpmc_queue_t queue;
+static int n_producers, items;
+static atomic_uchar *seen; // how many times each item was popped
+static atomic_int failed;
+
+static void fail(const char *what, int thread) {
+    if (atomic_exchange(&failed, 1) == 0) fprintf(stderr, "FALHOU: %s (thread %d, errno %d)\n", what, thread, errno);
+}
+
+static void *producer_thread(void *arg) {
+    int id = (int)(intptr_t)arg;
+    for (int i = 0; i < items && !atomic_load(&failed); i++) {
+        item_t item = { .producer = id, .seq = i };
+        if (mpmc_push(&queue, &item, OP_TIMEOUT_MS) != 0) fail("push esperou demasiado", id);
+    }
+    return NULL;
+}
+
+static void *consumer_thread(void *arg) {
+    int id = (int)(intptr_t)arg;
+    long *last = malloc(n_producers * sizeof(long)); // last seq seen from each producer
+    if (!last) {
+        fail("sem memória", id);
+        return NULL;
+    }
+    for (int p = 0; p < n_producers; p++) last[p] = -1;
+
+    while (!atomic_load(&failed)) {
+        item_t item;
+        if (mpmc_pop(&queue, &item, OP_TIMEOUT_MS) != 0) {
+            fail("pop esperou demasiado", id);
+            break;
+        }
+        if (item.producer == STOP) break;
+        if (item.producer >= (uint32_t)n_producers || item.seq >= (uint32_t)items) {
+            fail("item corrompido", id);
+            break;
+        }
+        // One consumer claims positions in order, so it sees each producer's items in order
+        if ((long)item.seq <= last[item.producer]) fail("itens de um produtor fora de ordem", id);
+        last[item.producer] = item.seq;
+        if (atomic_fetch_add(&seen[(size_t)item.producer * items + item.seq], 1) != 0) fail("item repetido", id);
+    }
+    free(last);
+    return NULL;
+}
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(const config_t *c) {
+    n_producers = c->producers;
+    size_t total = (size_t)c->producers * items;
+    seen = calloc(total, sizeof(atomic_uchar));
+    pthread_t *threads = malloc((c->producers + c->consumers) * sizeof(pthread_t));
+    if (!seen || !threads || mpmc_init(&queue, c->capacity, sizeof(item_t)) != 0) {
+        fprintf(stderr, "Sem memória\n");
+        exit(1);
+    }
+
+    double start = now_s();
+    for (int i = 0; i < c->consumers; i++) pthread_create(&threads[i], NULL, consumer_thread, (void *)(intptr_t)i);
+    for (int i = 0; i < c->producers; i++) {
+        pthread_create(&threads[c->consumers + i], NULL, producer_thread, (void *)(intptr_t)i);
+    }
+    for (int i = 0; i < c->producers; i++) pthread_join(threads[c->consumers + i], NULL);
+
+    // Queued behind every item, so each consumer stops once the items are gone
+    item_t stop = { .producer = STOP };
+    for (int i = 0; i < c->consumers; i++) {
+        if (mpmc_push(&queue, &stop, OP_TIMEOUT_MS) != 0) fail("push esperou demasiado", -1);
+    }
+    for (int i = 0; i < c->consumers; i++) pthread_join(threads[i], NULL);
+    double elapsed = now_s() - start;
+
+    for (size_t i = 0; i < total && !atomic_load(&failed); i++) {
+        if (atomic_load(&seen[i]) != 1) fail("item perdido", -1);
+    }
+    mpmc_stats_t stats;
+    mpmc_get_stats(&queue, &stats);
+    if (!atomic_load(&failed) && (stats.pushes != total + c->consumers || stats.pops != stats.pushes)) {
+        fail("contagem de pushes/pops errada", -1);
+    }
+
+    printf("%d produtores, %d consumidores, capacidade %zu: %s | %.0f itens/s | espera push %.1f ms, pop %.1f ms\n",
+           c->producers, c->consumers, c->capacity, atomic_load(&failed) ? "FALHOU" : "ok", total / elapsed,
+           stats.push_wait_ns / 1e6, stats.pop_wait_ns / 1e6);
+    fflush(stdout);
+
+    mpmc_destroy(&queue);
+    free(threads);
+    free(seen);
+    return atomic_load(&failed) ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    items = DEFAULT_ITEMS;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') items = atoi(optarg);
+        else items = 0;
+    }
+    if (items <= 0) {
+        fprintf(stderr, "Uso: %s [-n itens por produtor]\n", argv[0]);
+        return 1;
+    }
+
+    if (mpmc_init(&queue, 1, sizeof(item_t)) == 0) {
+        fprintf(stderr, "FALHOU: fila de capacidade 1 aceite\n");
+        return 1;
+    }
+    alarm(RUN_TIMEOUT_S);
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        if (run(&configs[i]) != 0) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "replay.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+struct replay_writer {
+    int fd;
+    uint64_t start_ns;
+    size_t used;
+    unsigned char buffer[REPLAY_BUFFER];
+};
+
+static atomic_uint sessions; // numbers the log files
+
+unsigned int replay_level_seed(unsigned int session_seed, int level_index) {
+    return session_seed ^ ((unsigned int)level_index * 0x9E3779B9u);
+}
+
+static void flush(replay_writer_t *w) {
+    size_t off = 0;
+    while (off < w->used) {
+        ssize_t n = write(w->fd, w->buffer + off, w->used - off);
+        if (n <= 0) break; // a broken log must not stop the game
+        off += n;
+    }
+    w->used = 0;
+}
+
+// Appends bytes, flushing only when the buffer is full
+static void append(replay_writer_t *w, const void *data, size_t len) {
+    if (w->used + len > REPLAY_BUFFER) flush(w);
+    memcpy(w->buffer + w->used, data, len);
+    w->used += len;
+}
+
+replay_writer_t *replay_open(const char *dir, unsigned int seed, int slot) {
+    if (!dir) return NULL;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/session-%d-%u.rpl", dir, getpid(), atomic_fetch_add(&sessions, 1));
+    replay_writer_t *w = malloc(sizeof(replay_writer_t));
+    if (!w) return NULL;
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd == -1) {
+        free(w);
+        return NULL;
+    }
+    w->start_ns = metrics_now_ns();
+    w->used = 0;
+
+    replay_header_t header = {
+        .magic = REPLAY_MAGIC,
+        .version = REPLAY_VERSION,
+        .seed = seed,
+        .slot = (uint32_t)slot,
+    };
+    append(w, &header, sizeof(header));
+    return w;
+}
+
+void replay_record(replay_writer_t *w, replay_kind_t kind, int arg, int value) {
+    if (!w) return;
+    replay_record_t r = {
+        .time_ms = (uint32_t)((metrics_now_ns() - w->start_ns) / 1000000),
+        .kind = (uint8_t)kind,
+        .arg = (uint8_t)arg,
+        .value = (int16_t)value,
+    };
+    append(w, &r, sizeof(r));
+}
+
+void replay_level(replay_writer_t *w, const char *filename) {
+    if (!w) return;
+    size_t len = strlen(filename);
+    if (len > 255) len = 255;
+    replay_record(w, REPLAY_LEVEL, (int)len, 0);
+    append(w, filename, len);
+}
+
+void replay_level_end(replay_writer_t *w, int outcome, board_t *board) {
+    if (!w) return;
+    replay_record(w, REPLAY_LEVEL_END, 0, outcome);
+    pacman_t *pac = &board->pacmans[0];
+    replay_check_t check = { .points = pac->points, .pos_x = pac->pos_x, .pos_y = pac->pos_y };
+    append(w, &check, sizeof(check));
+}
+
+void replay_close(replay_writer_t *w) {
+    if (!w) return;
+    flush(w);
+    close(w->fd);
+    free(w);
+}
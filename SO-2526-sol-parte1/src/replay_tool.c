@@ -0,0 +1,137 @@
+#include "board.h"
+#include "snapshot.h"
+#include "replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int levels, steps, mismatches;
+} replay_stats_t;
+
+// Reports a step or a check that came out differently from the log
+static void mismatch(replay_stats_t *stats, size_t index, replay_record_t *r, const char *what, int logged, int replayed) {
+    if (stats->mismatches++ < 10) {
+        printf("Divergência no registo %zu (%u ms): %s registado %d, replay %d\n",
+               index, r->time_ms, what, logged, replayed);
+    }
+}
+
+// Re-applies every step of a session log to the engine, single threaded
+static int run(unsigned char *data, size_t size, char *levels_dir, replay_stats_t *stats) {
+    replay_header_t *header = (replay_header_t *)data;
+    if (size < sizeof(replay_header_t) || header->magic != REPLAY_MAGIC || header->version != REPLAY_VERSION) {
+        fprintf(stderr, "Log de replay inválido\n");
+        return -1;
+    }
+    printf("Sessão do slot %u, seed %u\n", header->slot, header->seed);
+
+    board_t board;
+    board_snapshot_t checkpoint;
+    int loaded = 0, points = 0;
+    size_t off = sizeof(replay_header_t);
+
+    for (size_t index = 0; off + sizeof(replay_record_t) <= size; index++) {
+        replay_record_t r;
+        memcpy(&r, data + off, sizeof(r));
+        off += sizeof(r);
+
+        if (r.kind == REPLAY_LEVEL) {
+            char filename[MAX_FILENAME];
+            if (off + r.arg > size) break;
+            snprintf(filename, sizeof(filename), "%.*s.lvl", (int)r.arg, (char *)(data + off));
+            off += r.arg;
+
+            memset(&board, 0, sizeof(board_t));
+            if (load_level(&board, filename, levels_dir, points) != 0) {
+                fprintf(stderr, "Não foi possível carregar %s\n", filename);
+                return -1;
+            }
+            board.rng_state = replay_level_seed(header->seed, stats->levels++);
+            snapshot_init(&checkpoint, &board);
+            loaded = 1;
+            printf("Nível %s\n", board.level_name);
+            continue;
+        }
+        if (!loaded) continue;
+
+        switch (r.kind) {
+            case REPLAY_PACMAN: {
+                int res = play_pacman(&board, 0, (char)r.arg, &checkpoint);
+                if (res != r.value) mismatch(stats, index, &r, "pacman", r.value, res);
+                stats->steps++;
+                break;
+            }
+            case REPLAY_GHOST: {
+                int res = play_ghost(&board, r.arg);
+                if (res != r.value) mismatch(stats, index, &r, "fantasma", r.value, res);
+                stats->steps++;
+                break;
+            }
+            case REPLAY_CHECKPOINT:
+                snapshot_take(&checkpoint, &board);
+                break;
+            case REPLAY_RESTORE:
+                if (snapshot_restore(&checkpoint, &board) != 0) mismatch(stats, index, &r, "restauro", 0, -1);
+                break;
+            case REPLAY_LEVEL_END: {
+                replay_check_t check;
+                if (off + sizeof(check) > size) break;
+                memcpy(&check, data + off, sizeof(check));
+                off += sizeof(check);
+
+                pacman_t *pac = &board.pacmans[0];
+                if (pac->points != check.points) mismatch(stats, index, &r, "pontos", check.points, pac->points);
+                if (pac->pos_x != check.pos_x) mismatch(stats, index, &r, "posição x", check.pos_x, pac->pos_x);
+                if (pac->pos_y != check.pos_y) mismatch(stats, index, &r, "posição y", check.pos_y, pac->pos_y);
+                printf("   fim (%d): %d pontos em (%d, %d)\n", r.value, pac->points, pac->pos_x, pac->pos_y);
+
+                points = pac->points;
+                snapshot_free(&checkpoint);
+                unload_level(&board);
+                loaded = 0;
+                break;
+            }
+            default:
+                fprintf(stderr, "Registo desconhecido %d\n", r.kind);
+                return -1;
+        }
+    }
+
+    if (loaded) {
+        snapshot_free(&checkpoint);
+        unload_level(&board);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Uso: %s <replay_log> <levels_dir>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        perror("Erro ao abrir o log");
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "Erro ao ler o log\n");
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    replay_stats_t stats = {0};
+    int err = run(data, size, argv[2], &stats);
+    free(data);
+    if (err) return 1;
+
+    printf("Níveis: %d | Passos: %d | Divergências: %d\n", stats.levels, stats.steps, stats.mismatches);
+    return stats.mismatches ? 2 : 0;
+}
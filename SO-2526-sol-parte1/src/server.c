@@ -8,109 +8,256 @@
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
-#include <semaphore.h>
 #include <errno.h>
+#include <time.h>
 #include "protocol.h"
 #include "board.h"
-
-#define BUFF_SIZE 10
+#include "threads.h"
+#include "queue.h"
+#include "players.h"
+#include "leaderboard.h"
+#include "metrics.h"
+#include "loader.h"
+#include "manifest.h"
+#include "timer.h"
+#include "log.h"
+#include "trace.h"
+#include "frame.h"
+#include "placement.h"
+#include "fifo_io.h"
+#include "shard.h"
+#include "overload.h"
+
+#define BUFF_SIZE 10 // default admission queue capacity
+#define WORKER_IDLE_TIMEOUT 30 // seconds an idle worker waits before exiting
 
 typedef struct {
     char req_pipe[40];
     char notif_pipe[40];
-    char level_dir[256];
 } session_request_t; // Session request structure
 
-typedef struct {
-    session_request_t buf[BUFF_SIZE];
-    int in;
-    int out;
-    sem_t *sem_full;
-    sem_t *sem_empty;
-    pthread_mutex_t mutex;
-} request_buffer_t; // Request buffer structure
-
-request_buffer_t req_buffer;
+mpmc_queue_t req_queue; // Admission queue from main to the workers
 
 typedef struct {
-    int slot_id;
-    int points;
-    board_t *board;
-} game_entry_t; // Game entry for logging
+    pthread_mutex_t lock;
+    int live; // workers alive
+    int idle; // workers waiting for a request (or starting up)
+    int *free_slots; // stack of slot ids not owned by any worker
+    int n_free;
+    int idle_timeout; // seconds
+} worker_pool_t; // Elastic worker pool
+
+worker_pool_t pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .idle_timeout = WORKER_IDLE_TIMEOUT };
 
 // Global variables
 board_t **active_boards;
-char **active_player_names; 
-pthread_mutex_t active_players_lock = PTHREAD_MUTEX_INITIALIZER;
+player_set_t active_players; // request pipes of the players with a session
 
 int max_sessions = 0; 
 pthread_mutex_t boards_lock = PTHREAD_MUTEX_INITIALIZER;
 volatile sig_atomic_t print_stats_request = 0;
-
-char sem_full_name[64]; // Semaphore names
-char sem_empty_name[64];
+volatile sig_atomic_t trace_toggle_request = 0;
+char *trace_path = "trace.json";
+char *server_log_path = "server_log.txt";
 
 // Function prototypes
-int run_game_session(int req_fd, int notif_fd, char* level_dir, int slot_id, board_t **registry, pthread_mutex_t *registry_lock);
+void* worker_thread(void* arg);
+int run_game_session(int req_fd, int notif_fd, int slot_id, board_t **registry, pthread_mutex_t *registry_lock);
+void set_checkpoint_interval(int ticks);
+void set_replay_dir(char *dir);
+void set_memory_budget(size_t bytes);
+void set_session_log_prefix(char *prefix);
 
 // Signal handler
 void handle_signal(int sig) {
     if (sig == SIGUSR1) {
         print_stats_request = 1;
     }
+    else if (sig == SIGUSR2) {
+        trace_toggle_request = 1;
+    }
 }
 
-// Comparison function for sorting scores
-int compare_scores(const void *a, const void *b) {
-    game_entry_t *entryA = (game_entry_t *)a;
-    game_entry_t *entryB = (game_entry_t *)b;
-    return entryB->points - entryA->points;
+// Writes the last frame a session published, without touching its board
+void log_frame(FILE *f, int slot, size_t size) {
+    unsigned char *frame = malloc(size);
+    size_t len = frame ? frame_read(slot, frame, size) : 0;
+    if (len > size) {
+        // The session moved to a bigger level since the leaderboard was read
+        free(frame);
+        size = len;
+        frame = malloc(size);
+        len = frame ? frame_read(slot, frame, size) : 0;
+    }
+    if (len >= FRAME_HEADER && len <= size) {
+        // Clients with a small viewport get a window of the board
+        size_t header = (frame[0] == OP_CODE_BOARD_VIEW) ? FRAME_VIEW_HEADER : FRAME_HEADER;
+        int32_t metadata[FRAME_METADATA];
+        memcpy(metadata, frame + 1, sizeof(metadata));
+        int width = metadata[0], height = metadata[1];
+        for (int y = 0; y < height && header + (size_t)(y + 1) * width <= len; y++) {
+            fprintf(f, "   %.*s\n", width, (char *)frame + header + y * width);
+        }
+    }
+    free(frame);
 }
 
 // Logging function
 void log_active_games() {
-    FILE *f = fopen("server_log.txt", "w");
+    FILE *f = fopen(server_log_path, "w");
     if (!f) return;
 
-    pthread_mutex_lock(&boards_lock);
+    leaderboard_entry_t top[LEADERBOARD_K];
+    int count = leaderboard_top(top, LEADERBOARD_K);
+
+    if (shard_index() >= 0) fprintf(f, "=== PACMANIST SERVER LOG (PID %d, shard %d) ===\n", getpid(), shard_index());
+    else fprintf(f, "=== PACMANIST SERVER LOG (PID %d) ===\n", getpid());
+    fprintf(f, "Jogos Ativos: %d | A mostrar: Top %d\n", leaderboard_active(), LEADERBOARD_K);
+    level_manifest_t *manifest = manifest_acquire();
+    fprintf(f, "Níveis disponíveis: %d (manifesto v%lu)\n\n", manifest->n_levels, (unsigned long)manifest->version);
+    manifest_release(manifest);
+
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "-- Rank %d [Slot %d] --\n", i + 1, top[i].slot_id);
+        fprintf(f, "   Nível: %s | Dim: %dx%d | Memória: %zu KB\n", top[i].level_name, top[i].width, top[i].height,
+                top[i].bytes / 1024);
+        fprintf(f, "   Pacman Pos: (%d, %d)\n", top[i].pos_x, top[i].pos_y);
+        fprintf(f, "   PONTOS: %d \n", top[i].points);
+        if (i == 0) log_frame(f, top[i].slot_id, FRAME_HEADER + (size_t)top[i].width * top[i].height);
+        fprintf(f, "\n");
+    }
     
-    game_entry_t *entries = malloc(sizeof(game_entry_t) * max_sessions);
-    int count = 0;
-
-    for (int i = 0; i < max_sessions; i++) {
-        if (active_boards[i] != NULL && active_boards[i] != (board_t*)0x1) {
-            entries[count].slot_id = i;
-            entries[count].board = active_boards[i];
-            
-            if (active_boards[i]->pacmans && active_boards[i]->n_pacmans > 0) {
-                entries[count].points = active_boards[i]->pacmans[0].points;
-            } else {
-                entries[count].points = 0;
-            }
-            count++;
-        }
+    if (count == 0) fprintf(f, "Nenhum jogo ativo no momento.\n");
+
+    pthread_mutex_lock(&pool.lock);
+    fprintf(f, "\nWorkers: %d vivos | %d ociosos | %zu pedidos pendentes\n", pool.live, pool.idle, mpmc_size(&req_queue));
+    pthread_mutex_unlock(&pool.lock);
+    for (int c = 0; c < THREAD_CLASSES; c++) {
+        fprintf(f, "   Threads %-8s criadas: %lu | terminadas: %lu\n", thread_class_name(c),
+                threads_created(c), threads_reaped(c));
     }
 
-    qsort(entries, count, sizeof(game_entry_t), compare_scores);
+    fprintf(f, "\nSobrecarga: nível %d (%s) | subidas: %lu | descidas: %lu\n", overload_level(),
+            overload_level_name(overload_level()), (unsigned long)metrics_counter(METRIC_OVERLOAD_RAISED),
+            (unsigned long)metrics_counter(METRIC_OVERLOAD_LOWERED));
+    fprintf(f, "   Frames cortados: %lu | movimentos de fantasmas agrupados: %lu | admissão suspensa: %lu ms\n",
+            (unsigned long)metrics_counter(METRIC_FRAMES_SHED), (unsigned long)metrics_counter(METRIC_GHOST_WAKEUPS_SAVED),
+            (unsigned long)metrics_counter(METRIC_ADMISSION_PAUSED_MS));
+
+    fprintf(f, "\nI/O dos FIFOs: %s | syscalls: %lu | frames enviados: %lu\n",
+            fifo_io_mode() == FIFO_IO_URING ? "io_uring" : "bloqueante",
+            (unsigned long)metrics_counter(METRIC_FIFO_SYSCALLS), (unsigned long)metrics_counter(METRIC_FRAMES_SENT));
+
+    if (placement_groups() > 0) fprintf(f, "\nSessões por grupo de CPUs:\n");
+    for (int g = 0; g < placement_groups(); g++) {
+        char cpus[32];
+        placement_describe(g, cpus, sizeof(cpus));
+        fprintf(f, "   CPU %-10s %d\n", cpus, placement_sessions(g));
+    }
 
-    fprintf(f, "=== PACMANIST SERVER LOG (PID %d) ===\n", getpid());
-    fprintf(f, "Jogos Ativos: %d | A mostrar: Top 5\n\n", count);
+    mpmc_stats_t qs;
+    mpmc_get_stats(&req_queue, &qs);
+    uint64_t pops = qs.pops ? qs.pops : 1;
+    fprintf(f, "\nFila de admissão (capacidade %zu): %lu entradas | %lu saídas\n",
+            req_queue.capacity, (unsigned long)qs.pushes, (unsigned long)qs.pops);
+    fprintf(f, "   Espera main (fila cheia): total %.3f ms | max %.3f ms\n",
+            qs.push_wait_ns / 1e6, qs.push_wait_max_ns / 1e6);
+    fprintf(f, "   Espera workers (fila vazia): total %.3f ms | max %.3f ms\n",
+            qs.pop_wait_ns / 1e6, qs.pop_wait_max_ns / 1e6);
+    fprintf(f, "   Tempo na fila: média %.3f ms | max %.3f ms\n",
+            qs.residence_ns / 1e6 / pops, qs.residence_max_ns / 1e6);
 
-    int limit = (count < 5) ? count : 5;
-    
-    for (int i = 0; i < limit; i++) {
-        board_t *b = entries[i].board;
-        fprintf(f, "-- Rank %d [Slot %d] --\n", i + 1, entries[i].slot_id);
-        fprintf(f, "   Nível: %s | Dim: %dx%d\n", b->level_name, b->width, b->height);
-        fprintf(f, "   Pacman Pos: (%d, %d)\n", b->pacmans[0].pos_x, b->pacmans[0].pos_y);
-        fprintf(f, "   PONTOS: %d \n\n", entries[i].points);
+    fclose(f);
+    lockprof_report(); // process-wide, so once per SIGUSR1 and not per session
+}
+
+// Starts a trace recording, or ends the current one and writes it (SIGUSR2)
+void toggle_trace() {
+    trace_toggle_request = 0;
+    if (!atomic_load(&trace_on)) {
+        trace_start();
+        printf("Trace iniciado\n");
+        return;
     }
-    
-    if (count == 0) fprintf(f, "Nenhum jogo ativo no momento.\n");
+    long events = trace_stop(trace_path);
+    if (events < 0) perror("Erro ao gravar o trace");
+    else printf("Trace gravado em %s (%ld eventos)\n", trace_path, events);
+}
 
-    free(entries);
-    pthread_mutex_unlock(&boards_lock);
-    fclose(f);
+// Spawns workers while there are more queued requests than idle workers (pool.lock held)
+void pool_maybe_grow() {
+    while (mpmc_size(&req_queue) > (size_t)pool.idle && pool.live < max_sessions && pool.n_free > 0) {
+        int *id = malloc(sizeof(int));
+        *id = pool.free_slots[--pool.n_free];
+
+        pthread_t tid;
+        if (spawn_thread(&tid, THREAD_WORKER, worker_thread, id, 1) != 0) {
+            pool.free_slots[pool.n_free++] = *id;
+            free(id);
+            break;
+        }
+        pool.live++;
+        pool.idle++; // counted as idle until it claims a request
+    }
+}
+
+// Waits for a request, returns 0 (and gives the slot back) if the worker timed out idle
+int pool_wait_request(int slot_id, session_request_t *req) {
+    int got = mpmc_pop(&req_queue, req, pool.idle_timeout * 1000);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.idle--;
+    // A request may have been pushed right after the timeout
+    if (got == -1 && mpmc_try_pop(&req_queue, req) == -1) {
+        pool.live--;
+        pool.free_slots[pool.n_free++] = slot_id;
+        pthread_mutex_unlock(&pool.lock);
+        return 0;
+    }
+    pool_maybe_grow();
+    pthread_mutex_unlock(&pool.lock);
+    return 1;
+}
+
+// Gauges sampled by the metrics exporter
+double gauge_queue_depth() { return (double)mpmc_size(&req_queue); }
+double gauge_active_sessions() { return leaderboard_active(); }
+double gauge_workers_created() { return threads_created(THREAD_WORKER); }
+double gauge_workers_reaped() { return threads_reaped(THREAD_WORKER); }
+
+double gauge_levels_available() {
+    level_manifest_t *manifest = manifest_acquire();
+    int n = manifest->n_levels;
+    manifest_release(manifest);
+    return n;
+}
+
+double gauge_workers_live() {
+    pthread_mutex_lock(&pool.lock);
+    int live = pool.live;
+    pthread_mutex_unlock(&pool.lock);
+    return live;
+}
+
+// Tick rate since the previous scrape
+double gauge_ticks_per_second() {
+    static uint64_t last_ticks, last_ns;
+    uint64_t ticks = metrics_counter(METRIC_TICKS);
+    uint64_t now = metrics_now_ns();
+    double rate = (last_ns && now > last_ns) ? (ticks - last_ticks) * 1e9 / (now - last_ns) : 0;
+    last_ticks = ticks;
+    last_ns = now;
+    return rate;
+}
+
+void register_gauges() {
+    metrics_register_gauge("pacmanist_ticks_per_second", "Pacman ticks per second since the previous scrape", gauge_ticks_per_second);
+    metrics_register_gauge("pacmanist_admission_queue_depth", "Connect requests waiting for a worker", gauge_queue_depth);
+    metrics_register_gauge("pacmanist_active_sessions", "Sessions currently playing", gauge_active_sessions);
+    metrics_register_gauge("pacmanist_workers_live", "Worker threads alive", gauge_workers_live);
+    metrics_register_gauge("pacmanist_worker_threads_created", "Worker threads created since start", gauge_workers_created);
+    metrics_register_gauge("pacmanist_worker_threads_reaped", "Worker threads that exited idle", gauge_workers_reaped);
+    metrics_register_gauge("pacmanist_levels_available", "Levels in the current manifest", gauge_levels_available);
 }
 
 // Worker thread function
@@ -121,42 +268,25 @@ void* worker_thread(void* arg) {
     sigset_t set;
     sigemptyset(&set);
     sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
     pthread_sigmask(SIG_BLOCK, &set, NULL);
 
-    while (1) {
-        session_request_t req;
-
-        sem_wait(req_buffer.sem_full); 
-        
-        pthread_mutex_lock(&req_buffer.mutex);
-        req = req_buffer.buf[req_buffer.out];
-        req_buffer.out = (req_buffer.out + 1) % BUFF_SIZE;
-        pthread_mutex_unlock(&req_buffer.mutex);
-        
-        sem_post(req_buffer.sem_empty);
-
-        int is_duplicate = 0;
-        pthread_mutex_lock(&active_players_lock);
-        for (int i = 0; i < max_sessions; i++) {
-            if (active_player_names[i][0] != '\0' && strncmp(active_player_names[i], req.req_pipe, 40) == 0) {
-                is_duplicate = 1;
-                break;
-            }
-        }
-
-        if (is_duplicate) {
-            pthread_mutex_unlock(&active_players_lock);
+    session_request_t req;
+    while (pool_wait_request(slot_id, &req)) {
+        shard_request_taken();
+        if (player_set_insert(&active_players, req.req_pipe) != 0) {
             printf("Rejeitado cliente duplicado: %s\n", req.req_pipe);
             int fd1 = open(req.req_pipe, O_RDWR);
             int fd2 = open(req.notif_pipe, O_RDWR);
             if (fd1 != -1) close(fd1);
             if (fd2 != -1) close(fd2);
+            shard_request_done();
+            pthread_mutex_lock(&pool.lock);
+            pool.idle++;
+            pthread_mutex_unlock(&pool.lock);
             continue;
         }
 
-        strncpy(active_player_names[slot_id], req.req_pipe, 40);
-        pthread_mutex_unlock(&active_players_lock);
-
         int req_fd = open(req.req_pipe, O_RDWR);
         int notif_fd = open(req.notif_pipe, O_RDWR);
 
@@ -164,52 +294,170 @@ void* worker_thread(void* arg) {
             if (req_fd != -1) close(req_fd);
             if (notif_fd != -1) close(notif_fd);
         } else {
-            run_game_session(req_fd, notif_fd, req.level_dir, slot_id, active_boards, &boards_lock);
+            // The session threads inherit the CPUs of the worker
+            int group = placement_acquire();
+            run_game_session(req_fd, notif_fd, slot_id, active_boards, &boards_lock);
+            placement_release(group);
             close(req_fd);
             close(notif_fd);
         }
 
-        pthread_mutex_lock(&active_players_lock);
-        memset(active_player_names[slot_id], 0, 40);
-        pthread_mutex_unlock(&active_players_lock);
+        player_set_remove(&active_players, req.req_pipe);
         
         printf("Sessão no slot %d terminou.\n", slot_id);
+        shard_request_done();
+
+        pthread_mutex_lock(&pool.lock);
+        pool.idle++;
+        pthread_mutex_unlock(&pool.lock);
     }
+
+    thread_exited(THREAD_WORKER);
     return NULL;
 }
 
 // Main function
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Uso: %s <levels_dir> <max_games> <register_pipe>\n", argv[0]);
+    int opt;
+    int queue_capacity = BUFF_SIZE;
+    int loader_threads = LOADER_THREADS;
+    char *metrics_socket = NULL;
+    int cpus_per_session = 0; // CPUs per placement group, 0 = no pinning
+    fifo_io_mode_t io_mode = FIFO_IO_BLOCKING;
+    int n_shards = 0; // 0 = no dispatcher
+    shard_policy_t shard_policy = SHARD_LEAST_LOAD;
+    int overload_control = 1;
+    while ((opt = getopt(argc, argv, "i:q:m:l:c:r:VT:p:b:us:kO")) != -1) {
+        switch (opt) {
+            case 'i':
+                pool.idle_timeout = atoi(optarg);
+                break;
+            case 'q':
+                queue_capacity = atoi(optarg);
+                break;
+            case 'm':
+                metrics_socket = optarg;
+                break;
+            case 'l':
+                loader_threads = atoi(optarg);
+                break;
+            case 'c':
+                set_checkpoint_interval(atoi(optarg));
+                break;
+            case 'r':
+                set_replay_dir(optarg);
+                break;
+            case 'V':
+                timer_set_clock(TIMER_CLOCK_VIRTUAL);
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 'p':
+                cpus_per_session = atoi(optarg);
+                break;
+            case 'b':
+                set_memory_budget((size_t)atol(optarg) * 1024);
+                break;
+            case 'u':
+                io_mode = FIFO_IO_URING;
+                break;
+            case 's':
+                n_shards = atoi(optarg);
+                break;
+            case 'k':
+                shard_policy = SHARD_HASH;
+                break;
+            case 'O':
+                overload_control = 0;
+                break;
+            default:
+                argc = 0; // print usage
+        }
+    }
+
+    if (argc - optind != 3) {
+        fprintf(stderr, "Uso: %s [-i idle_timeout_s] [-q queue_capacity] [-m metrics_socket] [-l loader_threads] [-c checkpoint_ticks] [-r replay_dir] [-V] [-T trace_file] [-p cpus_per_group] [-b session_budget_kb] [-u] [-s shards] [-k] [-O] <levels_dir> <max_games> <register_pipe>\n", argv[0]);
         return 1;
     }
 
-    char* level_dir = argv[1];
-    max_sessions = atoi(argv[2]);
-    char* register_pipe_name = argv[3];
+    char* level_dir = argv[optind];
+    max_sessions = atoi(argv[optind + 1]);
+    char* register_pipe_name = argv[optind + 2];
 
-    active_boards = calloc(max_sessions, sizeof(board_t*));
-    
-    active_player_names = calloc(max_sessions, sizeof(char*));
-    for(int i = 0; i < max_sessions; i++) {
-        active_player_names[i] = calloc(1, 40);
+    // Before any thread is created: only this thread survives the fork of a shard
+    char *debug_log = "debug.log";
+    if (n_shards != 0) {
+        if (n_shards < 1 || n_shards > MAX_SHARDS || max_sessions < 1) {
+            fprintf(stderr, "Número de shards inválido (1 a %d)\n", MAX_SHARDS);
+            return 1;
+        }
+        int k = shard_dispatch(n_shards, shard_policy, register_pipe_name);
+        if (k < 0) {
+            perror("Erro ao iniciar o dispatcher");
+            return 1;
+        }
+
+        // Each shard takes its share of the games and files of its own
+        static char names[5][2 * MAX_FILENAME];
+        max_sessions = (max_sessions + n_shards - 1) / n_shards;
+        snprintf(names[0], sizeof(names[0]), "debug-s%d.log", k);
+        snprintf(names[1], sizeof(names[1]), "debug-s%d", k);
+        snprintf(names[2], sizeof(names[2]), "server_log-s%d.txt", k);
+        snprintf(names[3], sizeof(names[3]), "%s.s%d", trace_path, k);
+        debug_log = names[0];
+        set_session_log_prefix(names[1]);
+        server_log_path = names[2];
+        trace_path = names[3];
+        if (metrics_socket) {
+            snprintf(names[4], sizeof(names[4]), "%s.s%d", metrics_socket, k);
+            metrics_socket = names[4];
+        }
     }
+
+    // Before any thread is created: they all inherit the admission CPU
+    if (placement_init(cpus_per_session) != 0) {
+        perror("Erro ao fixar CPUs");
+        return 1;
+    }
+
+    active_boards = calloc(max_sessions, sizeof(board_t*));
     
-    req_buffer.in = 0; req_buffer.out = 0;
-    pthread_mutex_init(&req_buffer.mutex, NULL);
+    player_set_init(&active_players, max_sessions);
+    leaderboard_init(max_sessions);
+    frame_init(max_sessions);
     
-    snprintf(sem_empty_name, sizeof(sem_empty_name), "/sem_empty_%d", getpid());
-    snprintf(sem_full_name, sizeof(sem_full_name), "/sem_full_%d", getpid());
+    if (queue_capacity <= 0 || mpmc_init(&req_queue, queue_capacity, sizeof(session_request_t)) != 0) {
+        fprintf(stderr, "Erro ao criar fila de admissão\n");
+        return 1;
+    }
+
+    if (log_init(debug_log) != 0) {
+        perror("Erro ao abrir o log");
+        return 1;
+    }
+
+    if (manifest_init(level_dir) != 0) {
+        perror("Erro ao ler a diretoria de níveis");
+        return 1;
+    }
 
-    sem_unlink(sem_empty_name);
-    sem_unlink(sem_full_name);
+    if (loader_start(loader_threads) != 0) {
+        fprintf(stderr, "Erro ao criar threads de carregamento\n");
+        return 1;
+    }
 
-    req_buffer.sem_empty = sem_open(sem_empty_name, O_CREAT, 0644, BUFF_SIZE);
-    req_buffer.sem_full  = sem_open(sem_full_name, O_CREAT, 0644, 0);
+    if (fifo_io_init(io_mode) != io_mode) {
+        fprintf(stderr, "io_uring indisponível, a usar I/O bloqueante\n");
+    }
 
-    if (req_buffer.sem_empty == SEM_FAILED || req_buffer.sem_full == SEM_FAILED) {
-        perror("Erro ao criar semáforos");
+    register_gauges();
+    if (overload_start(overload_control, gauge_queue_depth) != 0) {
+        fprintf(stderr, "Erro ao criar thread de controlo de sobrecarga\n");
+        return 1;
+    }
+    if (metrics_socket && metrics_start_exporter(metrics_socket) != 0) {
+        perror("Erro ao criar socket de métricas");
         return 1;
     }
 
@@ -218,27 +466,43 @@ int main(int argc, char* argv[]) {
     sa.sa_flags = 0; 
     sigemptyset(&sa.sa_mask);
     sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
     signal(SIGPIPE, SIG_IGN);
 
-    pthread_t *workers = malloc(sizeof(pthread_t) * max_sessions);
-    for (int i = 0; i < max_sessions; i++) {
-        int *id = malloc(sizeof(int));
-        *id = i;
-        pthread_create(&workers[i], NULL, worker_thread, id);
+    // Workers are spawned on demand, slot ids are handed out from the free stack
+    pool.free_slots = malloc(sizeof(int) * max_sessions);
+    for (int i = max_sessions - 1; i >= 0; i--) {
+        pool.free_slots[pool.n_free++] = i;
     }
 
-    unlink(register_pipe_name);
-    if (mkfifo(register_pipe_name, 0666) == -1) { perror("FIFO"); return 1; }
+    if (shard_start_reporter() != 0) {
+        fprintf(stderr, "Erro ao criar thread de relatório do shard\n");
+        return 1;
+    }
+
+    // A shard reads the FIFO the dispatcher made for it
+    if (shard_index() >= 0) {
+        register_pipe_name = (char *)shard_pipe();
+    }
+    else {
+        unlink(register_pipe_name);
+        if (mkfifo(register_pipe_name, 0666) == -1) { perror("FIFO"); return 1; }
+    }
     int reg_fd = open(register_pipe_name, O_RDWR);
     if (reg_fd == -1) return 1;
 
     printf("Servidor (PID %d) pronto. Max jogadores: %d\n", getpid(), max_sessions);
+    fflush(stdout);
 
     while (1) {
         if (print_stats_request) {
             log_active_games();
             print_stats_request = 0;
         }
+        if (trace_toggle_request) toggle_trace();
+
+        // Clients wait in the FIFO while overload control holds admission
+        if (overload_admission_wait() != 0) continue;
 
         char buffer[81]; 
         ssize_t n = read(reg_fd, buffer, 81);
@@ -249,30 +513,22 @@ int main(int argc, char* argv[]) {
             session_request_t new_req;
             memcpy(new_req.req_pipe, buffer + 1, 40);
             memcpy(new_req.notif_pipe, buffer + 1 + 40, 40);
-            strncpy(new_req.level_dir, level_dir, 256);
 
-            while (sem_wait(req_buffer.sem_empty) == -1) {
-                if (errno == EINTR) {
-                    if (print_stats_request) { log_active_games(); print_stats_request = 0; }
-                    continue;
-                }
+            while (mpmc_push(&req_queue, &new_req, -1) == -1) {
+                if (print_stats_request) { log_active_games(); print_stats_request = 0; }
+                if (trace_toggle_request) toggle_trace();
             }
 
-            pthread_mutex_lock(&req_buffer.mutex);
-            req_buffer.buf[req_buffer.in] = new_req;
-            req_buffer.in = (req_buffer.in + 1) % BUFF_SIZE;
-            pthread_mutex_unlock(&req_buffer.mutex);
-            
-            sem_post(req_buffer.sem_full);
+            pthread_mutex_lock(&pool.lock);
+            pool_maybe_grow();
+            pthread_mutex_unlock(&pool.lock);
         }
     }
 
     close(reg_fd);
     unlink(register_pipe_name);
-    sem_close(req_buffer.sem_empty);
-    sem_close(req_buffer.sem_full);
-    sem_unlink(sem_empty_name);
-    sem_unlink(sem_full_name);
+    mpmc_destroy(&req_queue);
+    player_set_destroy(&active_players);
     
     return 0;
 }
\ No newline at end of file
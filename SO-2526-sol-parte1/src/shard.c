@@ -0,0 +1,434 @@
+#define _GNU_SOURCE // MAP_ANONYMOUS
+#include "shard.h"
+#include "protocol.h"
+#include "threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+
+#define CONNECT_MSG_SIZE 81 // op code, request and notification pipe names
+#define PIPE_NAME_SIZE 40
+
+static shard_stats_t *stats; // shared with every shard, NULL unsharded
+static int n_shards;
+static int self = -1;
+static char pipes[MAX_SHARDS][256];
+
+// Dispatcher only
+static int shard_fds[MAX_SHARDS];
+static uint64_t started_ns[MAX_SHARDS], restart_at_ns[MAX_SHARDS];
+static unsigned long restarts[MAX_SHARDS];
+static unsigned long spilled[MAX_SHARDS]; // requests that found the shard's FIFO full
+static unsigned long held; // requests that found every FIFO full and waited in the dispatcher
+static uint64_t base[MAX_SHARDS][METRIC_COUNTERS]; // counters of the shard's previous runs
+static shard_policy_t route_policy;
+static sigset_t wait_mask; // the mask the dispatcher was started with, its signals only arrive in ppoll
+static int next_shard; // least load ties go round robin from here
+
+typedef struct {
+    uint32_t point;
+    int shard;
+} ring_point_t;
+
+static ring_point_t ring[MAX_SHARDS * SHARD_VNODES];
+static int ring_size;
+
+static volatile sig_atomic_t report_request = 0;
+static volatile sig_atomic_t trace_request = 0;
+static volatile sig_atomic_t child_exited = 0;
+
+static void handle_dispatcher_signal(int sig) {
+    if (sig == SIGUSR1) report_request = 1;
+    else if (sig == SIGUSR2) trace_request = 1;
+    else if (sig == SIGCHLD) child_exited = 1;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// FNV-1a
+static uint32_t hash_bytes(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    // FNV spreads short keys that differ in the last byte poorly, finish with a mix
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+static int point_cmp(const void *a, const void *b) {
+    uint32_t x = ((const ring_point_t *)a)->point, y = ((const ring_point_t *)b)->point;
+    return (x > y) - (x < y);
+}
+
+static void build_ring() {
+    ring_size = 0;
+    for (int k = 0; k < n_shards; k++) {
+        for (int v = 0; v < SHARD_VNODES; v++) {
+            int key[2] = { k, v };
+            ring[ring_size++] = (ring_point_t){ hash_bytes(key, sizeof(key)), k };
+        }
+    }
+    qsort(ring, ring_size, sizeof(ring_point_t), point_cmp);
+}
+
+static unsigned long load_of(int k) {
+    return atomic_load(&stats[k].forwarded) - atomic_load(&stats[k].done);
+}
+
+// The first shard not tried yet that is up clockwise from the client's point, or the first
+// one not tried if none is up. -1 once every shard was tried
+static int route_hash(const char *client, const int *tried) {
+    uint32_t h = hash_bytes(client, strnlen(client, PIPE_NAME_SIZE));
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].point < h) lo = mid + 1;
+        else hi = mid;
+    }
+    int down = -1;
+    for (int i = 0; i < ring_size; i++) {
+        int k = ring[(lo + i) % ring_size].shard;
+        if (tried[k]) continue;
+        if (atomic_load(&stats[k].pid) != 0) return k;
+        if (down == -1) down = k;
+    }
+    return down;
+}
+
+// The shard not tried yet that is up with the fewest requests in course, or the next one
+// not tried if none is up. -1 once every shard was tried
+static int route_least_load(const int *tried) {
+    int best = -1, down = -1;
+    unsigned long best_load = 0;
+    for (int i = 0; i < n_shards; i++) {
+        int k = (next_shard + i) % n_shards;
+        if (tried[k]) continue;
+        if (atomic_load(&stats[k].pid) == 0) {
+            if (down == -1) down = k;
+            continue;
+        }
+        unsigned long load = load_of(k);
+        if (best == -1 || load < best_load) {
+            best = k;
+            best_load = load;
+        }
+    }
+    if (best == -1) best = down;
+    if (best != -1) next_shard = (best + 1) % n_shards;
+    return best;
+}
+
+// Writes a request to the shard the policy picks. The FIFOs never block: a shard that stopped
+// reading (stuck, a full admission queue, admission paused) has its requests spill over to
+// the next shard the policy would pick, so it can not stall the others. Returns -1 if every
+// FIFO is full
+static int forward(const char *buffer, ssize_t n) {
+    char client[PIPE_NAME_SIZE + 1] = {0};
+    memcpy(client, buffer + 1, PIPE_NAME_SIZE);
+    int tried[MAX_SHARDS] = {0};
+    int k;
+    while ((k = route_policy == SHARD_HASH ? route_hash(client, tried) : route_least_load(tried)) != -1) {
+        tried[k] = 1;
+        // Counted first: the shard may finish with it before the write returns
+        atomic_fetch_add(&stats[k].forwarded, 1);
+        if (write(shard_fds[k], buffer, n) == n) return 0;
+        atomic_fetch_sub(&stats[k].forwarded, 1);
+        spilled[k]++;
+    }
+    return -1;
+}
+
+// Forks shard k. Returns 0 in the shard, 1 in the dispatcher, -1 on error
+static int spawn_shard(int k) {
+    pid_t dispatcher = getpid();
+    fflush(stdout); // or the shard prints what the dispatcher had buffered again
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+
+    if (pid == 0) {
+        // The shard dies with the dispatcher
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != dispatcher) _exit(1);
+        signal(SIGCHLD, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &wait_mask, NULL);
+        for (int i = 0; i < n_shards; i++) close(shard_fds[i]);
+        self = k;
+        return 0;
+    }
+
+    atomic_store(&stats[k].pid, pid);
+    started_ns[k] = now_ns();
+    restart_at_ns[k] = 0;
+    printf("Shard %d iniciado (PID %d)\n", k, pid);
+    return 1;
+}
+
+// Accounts for a shard that exited and schedules its restart
+static void shard_down(int k, int status) {
+    if (WIFSIGNALED(status)) printf("Shard %d (PID %d) terminou com o sinal %d\n", k, atomic_load(&stats[k].pid), WTERMSIG(status));
+    else printf("Shard %d (PID %d) terminou com o código %d\n", k, atomic_load(&stats[k].pid), WEXITSTATUS(status));
+
+    for (int c = 0; c < METRIC_COUNTERS; c++) {
+        base[k][c] += atomic_load(&stats[k].counters[c]);
+        atomic_store(&stats[k].counters[c], 0);
+    }
+
+    // Sessions of the shard are lost, requests still in its FIFO go to the next one
+    int pending = 0;
+    ioctl(shard_fds[k], FIONREAD, &pending);
+    atomic_store(&stats[k].forwarded, (unsigned long)(pending / CONNECT_MSG_SIZE));
+    atomic_store(&stats[k].done, 0);
+    atomic_store(&stats[k].sessions, 0);
+    atomic_store(&stats[k].reported_ns, 0);
+    atomic_store(&stats[k].pid, 0);
+
+    uint64_t now = now_ns();
+    int crashed_early = now - started_ns[k] < (uint64_t)SHARD_RESTART_MS * 1000000;
+    restart_at_ns[k] = crashed_early ? now + (uint64_t)SHARD_RESTART_MS * 1000000 : now;
+    restarts[k]++;
+}
+
+static void reap_shards() {
+    child_exited = 0;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int k = 0; k < n_shards; k++) {
+            if (atomic_load(&stats[k].pid) == pid) shard_down(k, status);
+        }
+    }
+}
+
+// Per shard and total of what the shards reported
+static void write_report() {
+    report_request = 0;
+    FILE *f = fopen("server_log.txt", "w");
+    if (!f) return;
+
+    fprintf(f, "=== PACMANIST DISPATCHER (PID %d) ===\n", getpid());
+    fprintf(f, "Shards: %d | Encaminhamento: %s\n\n", n_shards,
+            route_policy == SHARD_HASH ? "hash consistente do cliente" : "menor carga");
+
+    uint64_t now = now_ns();
+    uint64_t total[METRIC_COUNTERS] = {0};
+    long sessions = 0, load = 0;
+    unsigned long spills = 0;
+    for (int k = 0; k < n_shards; k++) {
+        shard_stats_t *s = &stats[k];
+        int pid = atomic_load(&s->pid);
+        uint64_t reported = atomic_load(&s->reported_ns);
+        if (pid) fprintf(f, "-- Shard %d (PID %d) | reinícios: %lu --\n", k, pid, restarts[k]);
+        else fprintf(f, "-- Shard %d (em baixo) | reinícios: %lu --\n", k, restarts[k]);
+        fprintf(f, "   Carga: %lu | Pedidos em curso: %d | Encaminhados: %lu | Terminados: %lu | Desviados (FIFO cheia): %lu\n",
+                load_of(k), atomic_load(&s->sessions), atomic_load(&s->forwarded), atomic_load(&s->done), spilled[k]);
+        if (reported) fprintf(f, "   Último relatório há %.1f ms\n", (now - reported) / 1e6);
+
+        for (int c = 0; c < METRIC_COUNTERS; c++) {
+            uint64_t v = base[k][c] + atomic_load(&s->counters[c]);
+            total[c] += v;
+            fprintf(f, "   %-40s %lu\n", metrics_counter_name(c), (unsigned long)v);
+        }
+        sessions += atomic_load(&s->sessions);
+        load += load_of(k);
+        spills += spilled[k];
+        fprintf(f, "\n");
+    }
+
+    fprintf(f, "-- Total --\n");
+    fprintf(f, "   Carga: %ld | Pedidos em curso: %ld | Desviados: %lu | Retidos (todas as FIFOs cheias): %lu\n",
+            load, sessions, spills, held);
+    for (int c = 0; c < METRIC_COUNTERS; c++) {
+        fprintf(f, "   %-40s %lu\n", metrics_counter_name(c), (unsigned long)total[c]);
+    }
+    fclose(f);
+
+    // Every shard writes its own report too
+    for (int k = 0; k < n_shards; k++) {
+        int pid = atomic_load(&stats[k].pid);
+        if (pid) kill(pid, SIGUSR1);
+    }
+}
+
+static void forward_signal(int sig) {
+    for (int k = 0; k < n_shards; k++) {
+        int pid = atomic_load(&stats[k].pid);
+        if (pid) kill(pid, sig);
+    }
+}
+
+// Time until the next restart is due into ts. Returns NULL if none is
+static struct timespec *restart_timeout(uint64_t now, struct timespec *ts) {
+    uint64_t wait = UINT64_MAX;
+    for (int k = 0; k < n_shards; k++) {
+        if (atomic_load(&stats[k].pid) != 0 || restart_at_ns[k] == 0) continue;
+        uint64_t ns = restart_at_ns[k] > now ? restart_at_ns[k] - now : 0;
+        if (ns < wait) wait = ns;
+    }
+    if (wait == UINT64_MAX) return NULL;
+    ts->tv_sec = wait / 1000000000ull;
+    ts->tv_nsec = wait % 1000000000ull;
+    return ts;
+}
+
+int shard_dispatch(int shards, shard_policy_t policy, const char *register_pipe) {
+    if (shards <= 0 || shards > MAX_SHARDS) return -1;
+    n_shards = shards;
+    route_policy = policy;
+
+    stats = mmap(NULL, shards * sizeof(shard_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+        stats = NULL;
+        return -1;
+    }
+    memset(stats, 0, shards * sizeof(shard_stats_t));
+
+    // The FIFOs outlive the shards, so requests wait in them across a restart
+    for (int k = 0; k < shards; k++) {
+        snprintf(pipes[k], sizeof(pipes[k]), "%s.s%d", register_pipe, k);
+        unlink(pipes[k]);
+        if (mkfifo(pipes[k], 0666) == -1) return -1;
+        shard_fds[k] = open(pipes[k], O_RDWR | O_NONBLOCK);
+        if (shard_fds[k] == -1) return -1;
+    }
+    build_ring();
+
+    // Blocked outside ppoll: a signal that arrives after the flags were checked still
+    // cuts the wait short instead of waiting for the next client
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGUSR1);
+    sigaddset(&block, SIGUSR2);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &wait_mask);
+
+    struct sigaction sa;
+    sa.sa_handler = handle_dispatcher_signal;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int k = 0; k < shards; k++) {
+        int res = spawn_shard(k);
+        if (res <= 0) return res == 0 ? k : -1;
+    }
+
+    unlink(register_pipe);
+    if (mkfifo(register_pipe, 0666) == -1) return -1;
+    int reg_fd = open(register_pipe, O_RDWR);
+    if (reg_fd == -1) return -1;
+
+    char pending[CONNECT_MSG_SIZE];
+    ssize_t pending_len = 0; // a request no shard FIFO had room for
+    printf("Dispatcher (PID %d) pronto. Shards: %d | Encaminhamento: %s\n", getpid(), shards,
+           policy == SHARD_HASH ? "hash consistente" : "menor carga");
+    fflush(stdout);
+
+    while (1) {
+        if (child_exited) reap_shards();
+        if (report_request) write_report();
+        if (trace_request) {
+            trace_request = 0;
+            forward_signal(SIGUSR2);
+        }
+
+        uint64_t now = now_ns();
+        for (int k = 0; k < shards; k++) {
+            if (atomic_load(&stats[k].pid) != 0 || restart_at_ns[k] == 0 || restart_at_ns[k] > now) continue;
+            int res = spawn_shard(k);
+            if (res == 0) {
+                close(reg_fd);
+                return k;
+            }
+        }
+        fflush(stdout);
+
+        // While a request waits for room in a shard FIFO the next ones wait in the register FIFO
+        struct pollfd pfd[MAX_SHARDS];
+        int n_pfd = 1;
+        if (pending_len) {
+            for (int k = 0; k < shards; k++) pfd[k] = (struct pollfd){ .fd = shard_fds[k], .events = POLLOUT };
+            n_pfd = shards;
+        }
+        else {
+            pfd[0] = (struct pollfd){ .fd = reg_fd, .events = POLLIN };
+        }
+        struct timespec timeout;
+        if (ppoll(pfd, n_pfd, restart_timeout(now, &timeout), &wait_mask) <= 0) continue;
+
+        if (pending_len) {
+            if (forward(pending, pending_len) == 0) pending_len = 0;
+            continue;
+        }
+        ssize_t n = read(reg_fd, pending, CONNECT_MSG_SIZE);
+        if (n <= 0 || pending[0] != OP_CODE_CONNECT) continue;
+        if (forward(pending, n) != 0) {
+            pending_len = n;
+            held++;
+        }
+    }
+}
+
+int shard_index() {
+    return self;
+}
+
+const char *shard_pipe() {
+    return self >= 0 ? pipes[self] : NULL;
+}
+
+static void *reporter_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    shard_stats_t *s = &stats[self];
+    struct timespec period = { SHARD_REPORT_MS / 1000, (SHARD_REPORT_MS % 1000) * 1000000L };
+    while (1) {
+        for (int c = 0; c < METRIC_COUNTERS; c++) atomic_store(&s->counters[c], metrics_counter(c));
+        atomic_store(&s->reported_ns, now_ns());
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+int shard_start_reporter() {
+    if (self < 0) return 0;
+    pthread_t tid;
+    return spawn_thread(&tid, THREAD_SERVICE, reporter_thread, NULL, 1);
+}
+
+void shard_request_taken() {
+    if (self >= 0) atomic_fetch_add(&stats[self].sessions, 1);
+}
+
+void shard_request_done() {
+    if (self < 0) return;
+    atomic_fetch_sub(&stats[self].sessions, 1);
+    atomic_fetch_add(&stats[self].done, 1);
+}
@@ -0,0 +1,102 @@
+#include "snapshot.h"
+#include "metrics.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+int snapshot_init(board_snapshot_t *snap, board_t *board) {
+    memset(snap, 0, sizeof(board_snapshot_t));
+    snap->n_pages = board->n_pages;
+    snap->n_pacmans = board->n_pacmans;
+    snap->n_ghosts = board->n_ghosts;
+    snap->cells = malloc(sizeof(snapshot_cell_t) * board->n_pages * BOARD_PAGE_CELLS);
+    snap->pacmans = malloc(sizeof(pacman_t) * (board->n_pacmans ? board->n_pacmans : 1));
+    snap->ghosts = malloc(sizeof(ghost_t) * (board->n_ghosts ? board->n_ghosts : 1));
+    if (!snap->cells || !snap->pacmans || !snap->ghosts) {
+        snapshot_free(snap);
+        return -1;
+    }
+    return 0;
+}
+
+size_t snapshot_bytes(board_t *board) {
+    return sizeof(snapshot_cell_t) * board->n_pages * BOARD_PAGE_CELLS
+         + sizeof(pacman_t) * (board->n_pacmans ? board->n_pacmans : 1)
+         + sizeof(ghost_t) * (board->n_ghosts ? board->n_ghosts : 1);
+}
+
+void snapshot_free(board_snapshot_t *snap) {
+    free(snap->cells);
+    free(snap->pacmans);
+    free(snap->ghosts);
+    memset(snap, 0, sizeof(board_snapshot_t));
+}
+
+// Cells [first, last) of a page
+static void page_bounds(board_t *board, int page, int *first, int *last) {
+    *first = page * BOARD_PAGE_CELLS;
+    *last = *first + BOARD_PAGE_CELLS;
+    if (*last > board->width * board->height) *last = board->width * board->height;
+}
+
+void snapshot_take(board_snapshot_t *snap, board_t *board) {
+    if (!snap->cells) return;
+    uint64_t start = metrics_now_ns();
+    trace_begin("checkpoint");
+
+    for (int p = 0; p < snap->n_pages; p++) {
+        if (!board->dirty_pages[p]) continue;
+        int first, last;
+        page_bounds(board, p, &first, &last);
+        for (int i = first; i < last; i++) {
+            board_pos_t *cell = &board->board[i];
+            snap->cells[i].content = cell->content;
+            snap->cells[i].flags = (cell->has_dot ? CELL_DOT : 0) | (cell->has_portal ? CELL_PORTAL : 0);
+        }
+        board->dirty_pages[p] = 0;
+    }
+    memcpy(snap->pacmans, board->pacmans, sizeof(pacman_t) * snap->n_pacmans);
+    memcpy(snap->ghosts, board->ghosts, sizeof(ghost_t) * snap->n_ghosts);
+    snap->rng_state = board->rng_state;
+    snap->valid = 1;
+
+    trace_end("checkpoint");
+    metrics_observe_ns(HIST_CHECKPOINT, metrics_now_ns() - start);
+}
+
+int snapshot_restore(board_snapshot_t *snap, board_t *board) {
+    if (!snap->valid) return -1;
+    uint64_t start = metrics_now_ns();
+    trace_begin("restore");
+
+    // Pages that were not touched since the checkpoint still hold its contents
+    for (int p = 0; p < snap->n_pages; p++) {
+        if (!board->dirty_pages[p]) continue;
+        int first, last;
+        page_bounds(board, p, &first, &last);
+        for (int i = first; i < last; i++) {
+            board_pos_t *cell = &board->board[i];
+            cell->content = snap->cells[i].content;
+            cell->has_dot = (snap->cells[i].flags & CELL_DOT) != 0;
+            cell->has_portal = (snap->cells[i].flags & CELL_PORTAL) != 0;
+        }
+        board->dirty_pages[p] = 0;
+    }
+    memcpy(board->pacmans, snap->pacmans, sizeof(pacman_t) * snap->n_pacmans);
+    memcpy(board->ghosts, snap->ghosts, sizeof(ghost_t) * snap->n_ghosts);
+    board->rng_state = snap->rng_state;
+    snap->valid = 0;
+
+    trace_end("restore");
+    metrics_observe_ns(HIST_RESTORE, metrics_now_ns() - start);
+    return 0;
+}
+
+void snapshot_reset(board_snapshot_t *snap, board_t *board) {
+    if (!snap->valid) return;
+    memset(board->dirty_pages, 1, board->n_pages);
+    snapshot_restore(snap, board);
+    snap->valid = 1;
+    // As after load_level, so the first checkpoint of the new run copies every page
+    memset(board->dirty_pages, 1, board->n_pages);
+}
@@ -0,0 +1,58 @@
+#include "threads.h"
+#include <stdatomic.h>
+
+static const size_t stack_sizes[THREAD_CLASSES] = {
+    [THREAD_WORKER] = WORKER_STACK_SIZE,
+    [THREAD_PACMAN] = SESSION_STACK_SIZE,
+    [THREAD_GHOST] = SESSION_STACK_SIZE,
+    [THREAD_LISTENER] = SESSION_STACK_SIZE,
+    [THREAD_LOADER] = SESSION_STACK_SIZE,
+    [THREAD_SERVICE] = SESSION_STACK_SIZE,
+};
+
+static const char *class_names[THREAD_CLASSES] = {
+    [THREAD_WORKER] = "worker",
+    [THREAD_PACMAN] = "pacman",
+    [THREAD_GHOST] = "ghost",
+    [THREAD_LISTENER] = "listener",
+    [THREAD_LOADER] = "loader",
+    [THREAD_SERVICE] = "service",
+};
+
+static atomic_ulong created[THREAD_CLASSES];
+static atomic_ulong reaped[THREAD_CLASSES];
+
+int spawn_thread(pthread_t *tid, thread_class_t cls, void *(*fn)(void *), void *arg, int detached) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_sizes[cls]);
+    if (detached) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    int err = pthread_create(tid, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+
+    if (err == 0) atomic_fetch_add_explicit(&created[cls], 1, memory_order_relaxed);
+    return err;
+}
+
+int join_thread(pthread_t tid, thread_class_t cls, void **retval) {
+    int err = pthread_join(tid, retval);
+    if (err == 0) thread_exited(cls);
+    return err;
+}
+
+void thread_exited(thread_class_t cls) {
+    atomic_fetch_add_explicit(&reaped[cls], 1, memory_order_relaxed);
+}
+
+unsigned long threads_created(thread_class_t cls) {
+    return atomic_load_explicit(&created[cls], memory_order_relaxed);
+}
+
+unsigned long threads_reaped(thread_class_t cls) {
+    return atomic_load_explicit(&reaped[cls], memory_order_relaxed);
+}
+
+const char *thread_class_name(thread_class_t cls) {
+    return class_names[cls];
+}
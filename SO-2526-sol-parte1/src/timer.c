@@ -0,0 +1,262 @@
+#include "timer.h"
+#include "futex.h"
+#include "threads.h"
+#include "metrics.h"
+#include <pthread.h>
+#include <signal.h>
+
+#define L0_SIZE (1 << WHEEL_L0_BITS)
+#define LN_SIZE (1 << WHEEL_LN_BITS)
+#define MAX_DELTA ((1ull << (WHEEL_L0_BITS + (WHEEL_LEVELS - 1) * WHEEL_LN_BITS)) - 1)
+#define TICK_NS 1000000ull
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t armed; // signalled when the first timer is added to an empty wheel
+    uint64_t base_ns; // monotonic time of tick 0
+    uint64_t current; // last tick processed
+    uint64_t wake_tick; // tick the real clock driver sleeps until
+    atomic_uint rearm; // bumped to wake the driver before wake_tick
+    int pending;
+    int active; // tickers with a period that were not cancelled
+    timer_node_t *l0[L0_SIZE];
+    timer_node_t *ln[WHEEL_LEVELS - 1][LN_SIZE];
+} timer_wheel_t;
+
+static timer_wheel_t wheel = { .lock = PTHREAD_MUTEX_INITIALIZER, .armed = PTHREAD_COND_INITIALIZER };
+static pthread_once_t wheel_once = PTHREAD_ONCE_INIT;
+static timer_clock_t wheel_clock = TIMER_CLOCK_REAL;
+static _Atomic uint64_t virtual_ns; // virtual time, advanced by the driver
+
+void timer_set_clock(timer_clock_t clock) {
+    wheel_clock = clock;
+}
+
+uint64_t timer_now_ns() {
+    if (wheel_clock == TIMER_CLOCK_VIRTUAL) return atomic_load_explicit(&virtual_ns, memory_order_acquire);
+    return monotonic_ns();
+}
+
+static int level_shift(int level) {
+    return WHEEL_L0_BITS + level * WHEEL_LN_BITS;
+}
+
+// Puts a node in the slot for its expiry (wheel.lock held)
+static void wheel_insert(timer_node_t *node) {
+    uint64_t delta = node->expires - wheel.current;
+    timer_node_t **slot;
+
+    if (delta < L0_SIZE) {
+        slot = &wheel.l0[node->expires & (L0_SIZE - 1)];
+    }
+    else {
+        if (delta > MAX_DELTA) node->expires = wheel.current + MAX_DELTA;
+        int level = 0;
+        while (level < WHEEL_LEVELS - 2 && delta >= (1ull << level_shift(level + 1))) level++;
+        slot = &wheel.ln[level][(node->expires >> level_shift(level)) & (LN_SIZE - 1)];
+    }
+    node->next = *slot;
+    if (node->next) node->next->pprev = &node->next;
+    node->pprev = slot;
+    *slot = node;
+}
+
+// Wakes the owner of a node that left the wheel (wheel.lock held)
+static void wheel_fire(timer_node_t *node) {
+    node->pprev = NULL;
+    wheel.pending--;
+    atomic_store(&node->fired, 1);
+    futex_wake(&node->fired, 1);
+}
+
+// Moves the timers of an upper level slot down, returns the slot index (wheel.lock held)
+static int wheel_cascade(int level) {
+    int index = (wheel.current >> level_shift(level)) & (LN_SIZE - 1);
+    timer_node_t *node = wheel.ln[level][index];
+    wheel.ln[level][index] = NULL;
+    while (node) {
+        timer_node_t *next = node->next;
+        wheel_insert(node);
+        node = next;
+    }
+    return index;
+}
+
+// Advances one tick and fires the timers that expire on it, returns how many (wheel.lock held)
+static int wheel_advance() {
+    wheel.current++;
+    if (wheel_clock == TIMER_CLOCK_VIRTUAL) {
+        atomic_store_explicit(&virtual_ns, wheel.current * TICK_NS, memory_order_release);
+    }
+    int index = wheel.current & (L0_SIZE - 1);
+
+    if (index == 0) {
+        for (int level = 0; level < WHEEL_LEVELS - 1 && wheel_cascade(level) == 0; level++);
+    }
+
+    int fired = 0;
+    timer_node_t *node = wheel.l0[index];
+    wheel.l0[index] = NULL;
+    while (node) {
+        timer_node_t *next = node->next; // the owner may reuse the node once fired
+        wheel_fire(node);
+        node = next;
+        fired++;
+    }
+    return fired;
+}
+
+// First tick with an L0 timer, or the next cascade if the slots up to it are empty (wheel.lock held)
+static uint64_t wheel_next_tick() {
+    uint64_t tick = wheel.current + 1;
+    while (wheel.l0[tick & (L0_SIZE - 1)] == NULL && (tick & (L0_SIZE - 1)) != 0) tick++;
+    return tick;
+}
+
+// Wakes the driver if the last running ticker owner just went to sleep (wheel.lock held)
+static void wheel_check_idle() {
+    if (wheel.pending > 0 && wheel.pending >= wheel.active) pthread_cond_signal(&wheel.armed);
+}
+
+static void *wheel_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&wheel.lock);
+    while (1) {
+        // Idle wheel: no wakeups at all
+        while (wheel.pending == 0) pthread_cond_wait(&wheel.armed, &wheel.lock);
+
+        // Sleep over the empty ticks. An earlier timer added meanwhile bumps rearm
+        wheel.wake_tick = wheel_next_tick();
+        uint64_t next_ns = wheel.base_ns + wheel.wake_tick * TICK_NS;
+        unsigned seq = atomic_load(&wheel.rearm);
+        pthread_mutex_unlock(&wheel.lock);
+
+        futex_wait(&wheel.rearm, seq, next_ns);
+
+        pthread_mutex_lock(&wheel.lock);
+        uint64_t now_tick = (monotonic_ns() - wheel.base_ns) / TICK_NS;
+        while (wheel.current < now_tick) wheel_advance();
+    }
+    return NULL;
+}
+
+// Driver of the virtual clock: never sleeps on time, only waits for every owner to block
+static void *virtual_wheel_thread(void *arg) {
+    (void)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&wheel.lock);
+    while (1) {
+        while (wheel.pending == 0 || wheel.pending < wheel.active) pthread_cond_wait(&wheel.armed, &wheel.lock);
+        // Everyone is asleep: skip the empty ticks up to the next expiry
+        while (wheel_advance() == 0);
+        metrics_inc(METRIC_VIRTUAL_JUMPS, 1);
+    }
+    return NULL;
+}
+
+static void wheel_start() {
+    wheel.base_ns = timer_now_ns();
+    wheel.current = 0;
+    pthread_t tid;
+    spawn_thread(&tid, THREAD_SERVICE, wheel_clock == TIMER_CLOCK_VIRTUAL ? virtual_wheel_thread : wheel_thread, NULL, 1);
+}
+
+void ticker_init(ticker_t *t, int period_ms, atomic_ulong *session_overruns) {
+    pthread_once(&wheel_once, wheel_start);
+    t->period_ns = (period_ms > 0) ? (uint64_t)period_ms * TICK_NS : 0;
+    t->ticks = 0;
+    t->overruns = 0;
+    t->session_overruns = session_overruns;
+    t->cancelled = 0;
+    t->node.pprev = NULL;
+
+    // Registered before reading the clock, so the virtual clock can not move in between.
+    // A ticker without a period never sleeps and is not waited for
+    pthread_mutex_lock(&wheel.lock);
+    if (t->period_ns) wheel.active++;
+    t->next_ns = timer_now_ns() + t->period_ns;
+    pthread_mutex_unlock(&wheel.lock);
+}
+
+int ticker_wait(ticker_t *t) {
+    uint64_t deadline = t->next_ns;
+    t->next_ns += t->period_ns;
+    t->ticks++;
+    if (t->period_ns == 0) return 0;
+
+    uint64_t now = timer_now_ns();
+    if (now >= deadline) {
+        // Late: run now and drop the periods that were missed entirely
+        int missed = (now - deadline) / t->period_ns;
+        t->next_ns += missed * t->period_ns;
+        t->overruns++;
+        if (t->session_overruns) atomic_fetch_add_explicit(t->session_overruns, 1, memory_order_relaxed);
+        metrics_inc(METRIC_TICK_OVERRUNS, 1);
+        return missed;
+    }
+
+    timer_node_t *node = &t->node;
+    atomic_store(&node->fired, 0);
+
+    pthread_mutex_lock(&wheel.lock);
+    if (t->cancelled) {
+        pthread_mutex_unlock(&wheel.lock);
+        return 0;
+    }
+    // Round up so the wakeup is never before the deadline
+    node->expires = (deadline - wheel.base_ns + TICK_NS - 1) / TICK_NS;
+    if (node->expires <= wheel.current) node->expires = wheel.current + 1;
+    wheel_insert(node);
+    if (wheel_clock == TIMER_CLOCK_VIRTUAL) {
+        wheel.pending++;
+        wheel_check_idle();
+    }
+    else if (wheel.pending++ == 0) {
+        pthread_cond_signal(&wheel.armed);
+    }
+    else if (node->expires < wheel.wake_tick) {
+        atomic_fetch_add(&wheel.rearm, 1);
+        futex_wake(&wheel.rearm, 1);
+    }
+    pthread_mutex_unlock(&wheel.lock);
+
+    while (atomic_load(&node->fired) == 0) futex_wait(&node->fired, 0, 0);
+    return 0;
+}
+
+void ticker_skip(ticker_t *t, int periods) {
+    if (periods > 0) t->next_ns += (uint64_t)periods * t->period_ns;
+}
+
+void ticker_cancel(ticker_t *t) {
+    pthread_mutex_lock(&wheel.lock);
+    if (!t->cancelled && t->period_ns) wheel.active--;
+    t->cancelled = 1;
+    timer_node_t *node = &t->node;
+    if (node->pprev) {
+        *node->pprev = node->next;
+        if (node->next) node->next->pprev = node->pprev;
+        wheel_fire(node);
+    }
+    // The owner may have been the last one keeping the virtual clock still
+    if (wheel_clock == TIMER_CLOCK_VIRTUAL) wheel_check_idle();
+    pthread_mutex_unlock(&wheel.lock);
+}
+
+int timer_wheel_pending() {
+    pthread_mutex_lock(&wheel.lock);
+    int pending = wheel.pending;
+    pthread_mutex_unlock(&wheel.lock);
+    return pending;
+}
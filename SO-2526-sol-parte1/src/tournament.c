@@ -0,0 +1,310 @@
+#include "board.h"
+#include "parser.h"
+#include "snapshot.h"
+#include "manifest.h"
+#include "replay.h"
+#include "threads.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#define DEFAULT_SEEDS 8
+#define DEFAULT_MAX_TICKS 10000 // pacman ticks per match
+
+typedef enum {
+    END_CLEARED = 0, // every level of the manifest
+    END_DEAD,
+    END_QUIT, // 'Q' in the script
+    END_TIMEOUT,
+} match_end_t;
+
+static const char *end_names[] = { "todos", "morto", "saiu", "tempo" };
+
+typedef struct {
+    char *path;
+    command_t *moves;
+    int n_moves;
+} script_t;
+
+typedef struct {
+    int script;
+    unsigned int seed;
+    int points;
+    int levels_cleared;
+    long ticks; // pacman ticks survived
+    long ghost_ticks;
+    match_end_t end;
+} match_t;
+
+typedef struct {
+    int script;
+    int matches;
+    long points, levels, ticks;
+    int best;
+} ranking_t;
+
+static level_manifest_t *manifest;
+static script_t *scripts;
+static match_t *matches;
+static int n_matches;
+static atomic_int next_match; // matches are handed out in order, one at a time
+static long max_ticks = DEFAULT_MAX_TICKS;
+
+// Plays one level the way the session threads pace it: the pacman moves at 0, TEMPO,
+// 2 TEMPO... and each ghost every TEMPO * (1 + PASSO). On the same instant the pacman goes
+// first. Returns 1 if the portal was reached, otherwise sets how the match ended
+static int play_level(board_t *board, board_snapshot_t *checkpoint, match_t *match) {
+    pacman_t *pac = &board->pacmans[0];
+    long tempo = board->tempo > 0 ? board->tempo : 1;
+    long pac_next = 0;
+    long ghost_next[MAX_GHOSTS], period[MAX_GHOSTS];
+    for (int i = 0; i < board->n_ghosts; i++) {
+        period[i] = tempo * (1 + board->ghosts[i].passo);
+        ghost_next[i] = period[i];
+    }
+
+    while (1) {
+        long now = pac_next;
+        for (int i = 0; i < board->n_ghosts; i++) {
+            if (ghost_next[i] < now) now = ghost_next[i];
+        }
+
+        if (pac_next == now) {
+            // Killed by a ghost since the last tick
+            if (!pac->alive && snapshot_restore(checkpoint, board) != 0) {
+                match->end = END_DEAD;
+                return 0;
+            }
+            if (match->ticks >= max_ticks) {
+                match->end = END_TIMEOUT;
+                return 0;
+            }
+            if (pac->n_moves > 0 && pac->moves[pac->current_move % pac->n_moves].command == 'Q') {
+                match->end = END_QUIT;
+                return 0;
+            }
+
+            int res = play_pacman(board, 0, '\0', checkpoint);
+            match->ticks++;
+            if (res == REACHED_PORTAL) return 1;
+            if (res == DEAD_PACMAN) {
+                match->end = END_DEAD;
+                return 0;
+            }
+            pac_next += tempo;
+        }
+
+        for (int i = 0; i < board->n_ghosts; i++) {
+            if (ghost_next[i] != now) continue;
+            play_ghost(board, i);
+            match->ghost_ticks++;
+            ghost_next[i] += period[i];
+        }
+    }
+}
+
+// A level loaded once by a runner thread and reset before every match
+typedef struct {
+    int loaded; // 1 loaded, -1 could not be loaded
+    board_t board;
+    board_snapshot_t initial; // the level as loaded
+} level_cache_t;
+
+static board_t *cached_level(level_cache_t *cache, int l) {
+    level_cache_t *c = &cache[l];
+    if (c->loaded == 0) {
+        c->loaded = -1;
+        if (load_level(&c->board, manifest->levels[l].filename, manifest->dir, 0) == 0) {
+            if (snapshot_init(&c->initial, &c->board) == 0) {
+                snapshot_take(&c->initial, &c->board);
+                c->loaded = 1;
+            }
+            else {
+                unload_level(&c->board);
+            }
+        }
+    }
+    if (c->loaded < 0) return NULL;
+    snapshot_reset(&c->initial, &c->board);
+    return &c->board;
+}
+
+// Plays the levels of the manifest in order until the pacman stops
+static void play_match(match_t *match, level_cache_t *cache) {
+    script_t *script = &scripts[match->script];
+    match->end = END_CLEARED;
+
+    for (int l = 0; l < manifest->n_levels; l++) {
+        board_t *board = cached_level(cache, l);
+        if (!board) continue;
+
+        // The level decides where the pacman starts, the script how it moves. Moves are
+        // read only, every runner plays from the same script
+        pacman_t *pac = &board->pacmans[0];
+        pac->moves = script->moves;
+        pac->n_moves = script->n_moves;
+        pac->current_move = 0;
+        pac->turns_left = 0;
+        pac->points = match->points;
+        board->rng_state = replay_level_seed(match->seed, l);
+
+        board_snapshot_t checkpoint;
+        snapshot_init(&checkpoint, board);
+        int cleared = play_level(board, &checkpoint, match);
+        match->points = pac->points;
+        snapshot_free(&checkpoint);
+
+        if (!cleared) return;
+        match->levels_cleared++;
+    }
+}
+
+static void *runner_thread(void *arg) {
+    (void)arg;
+    level_cache_t *cache = calloc(manifest->n_levels, sizeof(level_cache_t));
+    int i;
+    while ((i = atomic_fetch_add_explicit(&next_match, 1, memory_order_relaxed)) < n_matches) {
+        play_match(&matches[i], cache);
+    }
+
+    for (int l = 0; l < manifest->n_levels; l++) {
+        if (cache[l].loaded <= 0) continue;
+        snapshot_reset(&cache[l].initial, &cache[l].board); // the level's own moves are freed
+        snapshot_free(&cache[l].initial);
+        unload_level(&cache[l].board);
+    }
+    free(cache);
+    return NULL;
+}
+
+// Best mean score first, then more levels, then longer survival
+static int ranking_cmp(const void *a, const void *b) {
+    const ranking_t *x = a, *y = b;
+    long lhs = x->points * y->matches, rhs = y->points * x->matches;
+    if (lhs != rhs) return lhs < rhs ? 1 : -1;
+    lhs = x->levels * y->matches; rhs = y->levels * x->matches;
+    if (lhs != rhs) return lhs < rhs ? 1 : -1;
+    lhs = x->ticks * y->matches; rhs = y->ticks * x->matches;
+    if (lhs != rhs) return lhs < rhs ? 1 : -1;
+    return x->script - y->script;
+}
+
+static void print_results(int n_scripts, int n_seeds, int n_threads, uint64_t elapsed_ns) {
+    ranking_t *ranking = calloc(n_scripts, sizeof(ranking_t));
+    long ticks = 0, ghost_ticks = 0;
+    for (int s = 0; s < n_scripts; s++) {
+        ranking[s].script = s;
+        ranking[s].best = -1;
+    }
+    for (int i = 0; i < n_matches; i++) {
+        match_t *m = &matches[i];
+        ranking_t *r = &ranking[m->script];
+        r->matches++;
+        r->points += m->points;
+        r->levels += m->levels_cleared;
+        r->ticks += m->ticks;
+        if (m->points > r->best) r->best = m->points;
+        ticks += m->ticks;
+        ghost_ticks += m->ghost_ticks;
+    }
+    qsort(ranking, n_scripts, sizeof(ranking_t), ranking_cmp);
+
+    printf("%-4s %-32s %10s %8s %8s %10s\n", "#", "Script", "Pontos", "Melhor", "Níveis", "Passos");
+    for (int s = 0; s < n_scripts; s++) {
+        ranking_t *r = &ranking[s];
+        int n = r->matches ? r->matches : 1;
+        printf("%-4d %-32s %10.1f %8d %8.2f %10.1f\n", s + 1, scripts[r->script].path,
+               (double)r->points / n, r->best, (double)r->levels / n, (double)r->ticks / n);
+    }
+
+    // How the matches ended
+    int ends[4] = {0};
+    for (int i = 0; i < n_matches; i++) ends[matches[i].end]++;
+    printf("\nFim dos jogos:");
+    for (int e = 0; e < 4; e++) printf(" %s %d%s", end_names[e], ends[e], e < 3 ? " |" : "\n");
+
+    double secs = elapsed_ns / 1e9;
+    printf("\n%d jogos (%d scripts x %d seeds, %d níveis) em %.3f s com %d threads\n",
+           n_matches, n_scripts, n_seeds, manifest->n_levels, secs, n_threads);
+    printf("   %.0f jogos/s | %.0f passos pacman/s | %.0f passos fantasma/s\n",
+           n_matches / secs, ticks / secs, ghost_ticks / secs);
+    free(ranking);
+}
+
+int main(int argc, char *argv[]) {
+    int n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int n_seeds = DEFAULT_SEEDS;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:s:t:")) != -1) {
+        switch (opt) {
+            case 'j':
+                n_threads = atoi(optarg);
+                break;
+            case 's':
+                n_seeds = atoi(optarg);
+                break;
+            case 't':
+                max_ticks = atol(optarg);
+                break;
+            default:
+                argc = 0; // print usage
+        }
+    }
+
+    if (argc - optind < 2 || n_threads <= 0 || n_seeds <= 0) {
+        fprintf(stderr, "Uso: %s [-j threads] [-s seeds] [-t max_ticks] <levels_dir> <script.p>...\n", argv[0]);
+        return 1;
+    }
+
+    if (manifest_load(argv[optind]) != 0) {
+        perror("Erro ao ler a diretoria de níveis");
+        return 1;
+    }
+    manifest = manifest_acquire();
+    if (manifest->n_levels == 0) {
+        fprintf(stderr, "Nenhum nível em %s\n", argv[optind]);
+        return 1;
+    }
+
+    int n_scripts = argc - optind - 1;
+    scripts = calloc(n_scripts, sizeof(script_t));
+    for (int s = 0; s < n_scripts; s++) {
+        scripts[s].path = argv[optind + 1 + s];
+        scripts[s].n_moves = read_pacman_script(scripts[s].path, &scripts[s].moves);
+        if (scripts[s].n_moves < 0) {
+            fprintf(stderr, "Erro ao ler o script %s\n", scripts[s].path);
+            return 1;
+        }
+    }
+
+    n_matches = n_scripts * n_seeds;
+    matches = calloc(n_matches, sizeof(match_t));
+    for (int i = 0; i < n_matches; i++) {
+        matches[i].script = i / n_seeds;
+        matches[i].seed = (unsigned int)(i % n_seeds) + 1;
+    }
+    if (n_threads > n_matches) n_threads = n_matches;
+
+    uint64_t start = metrics_now_ns();
+    pthread_t *tids = malloc(n_threads * sizeof(pthread_t));
+    int spawned = 0;
+    for (; spawned < n_threads; spawned++) {
+        // load_level runs on these, so they get the worker stack
+        if (spawn_thread(&tids[spawned], THREAD_WORKER, runner_thread, NULL, 0) != 0) break;
+    }
+    if (spawned == 0) runner_thread(NULL);
+    for (int t = 0; t < spawned; t++) join_thread(tids[t], THREAD_WORKER, NULL);
+    uint64_t elapsed = metrics_now_ns() - start;
+
+    print_results(n_scripts, n_seeds, spawned ? spawned : 1, elapsed);
+
+    free(tids);
+    free(matches);
+    for (int s = 0; s < n_scripts; s++) free(scripts[s].moves);
+    free(scripts);
+    manifest_release(manifest);
+    return 0;
+}
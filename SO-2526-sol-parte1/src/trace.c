@@ -0,0 +1,220 @@
+#include "trace.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct {
+    uint64_t ts;
+    const char *name;
+    char phase; // 'B' or 'E'
+} trace_event_t;
+
+typedef struct trace_chunk {
+    struct trace_chunk *next;
+    trace_event_t events[TRACE_CHUNK];
+} trace_chunk_t;
+
+/*Events of one thread, in chunks linked as they fill. Only the owner writes it; trace_stop
+reads the first count events of the buffers that belong to the recording being written*/
+typedef struct trace_buffer {
+    int id; // tid in the trace
+    atomic_int in_use; // owned by a live thread
+    atomic_uint gen; // recording the events belong to
+    atomic_int count;
+    int dropped;
+    int session;
+    char name[TRACE_NAME];
+    struct trace_buffer *next; // buffers are never unlinked, only reused
+    trace_chunk_t *chunks; // NULL until the first event
+    trace_chunk_t *cur; // chunk being written (owner only)
+} trace_buffer_t;
+
+atomic_int trace_on;
+static atomic_uint generation; // bumped by every trace_start
+static uint64_t start_ns;
+static _Atomic(trace_buffer_t *) buffers;
+static atomic_int n_buffers;
+static atomic_int n_chunks;
+static pthread_key_t buffer_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static _Thread_local trace_buffer_t *my_buffer;
+static _Thread_local int my_session = -1;
+static _Thread_local char my_name[TRACE_NAME];
+
+static void release_buffer(void *arg) {
+    trace_buffer_t *b = arg;
+    atomic_store_explicit(&b->in_use, 0, memory_order_release);
+}
+
+static void make_key() {
+    pthread_key_create(&buffer_key, release_buffer);
+}
+
+// A buffer of an exited thread is reused only once its events are no longer wanted
+static trace_buffer_t *claim_buffer(unsigned gen) {
+    pthread_once(&key_once, make_key);
+    for (trace_buffer_t *b = atomic_load(&buffers); b; b = b->next) {
+        int expected = 0;
+        if (atomic_load(&b->gen) == gen || atomic_load(&b->in_use)) continue;
+        if (atomic_compare_exchange_strong(&b->in_use, &expected, 1)) {
+            pthread_setspecific(buffer_key, b);
+            return b;
+        }
+    }
+
+    trace_buffer_t *b = malloc(sizeof(trace_buffer_t));
+    if (!b) return NULL;
+    b->id = atomic_fetch_add(&n_buffers, 1) + 1;
+    atomic_init(&b->in_use, 1);
+    atomic_init(&b->gen, gen - 1);
+    atomic_init(&b->count, 0);
+    b->chunks = NULL;
+    b->next = atomic_load(&buffers);
+    while (!atomic_compare_exchange_weak(&buffers, &b->next, b));
+    pthread_setspecific(buffer_key, b);
+    return b;
+}
+
+static trace_chunk_t *new_chunk() {
+    if (atomic_fetch_add(&n_chunks, 1) >= TRACE_MAX_CHUNKS) {
+        atomic_fetch_sub(&n_chunks, 1);
+        return NULL;
+    }
+    trace_chunk_t *c = malloc(sizeof(trace_chunk_t));
+    if (!c) {
+        atomic_fetch_sub(&n_chunks, 1);
+        return NULL;
+    }
+    c->next = NULL;
+    return c;
+}
+
+static void free_chunks(trace_chunk_t *c) {
+    int freed = 0;
+    while (c) {
+        trace_chunk_t *next = c->next;
+        free(c);
+        c = next;
+        freed++;
+    }
+    atomic_fetch_sub(&n_chunks, freed);
+}
+
+static void name_buffer(trace_buffer_t *b) {
+    b->session = my_session;
+    if (my_name[0]) snprintf(b->name, sizeof(b->name), "%s", my_name);
+    else snprintf(b->name, sizeof(b->name), "thread %d", b->id);
+}
+
+void trace_record(const char *name, char phase) {
+    unsigned gen = atomic_load_explicit(&generation, memory_order_acquire);
+    trace_buffer_t *b = my_buffer;
+    if (!b && !(b = my_buffer = claim_buffer(gen))) return;
+
+    if (atomic_load_explicit(&b->gen, memory_order_relaxed) != gen) {
+        // First event of this thread in the recording: one chunk is kept from the last one
+        if (b->chunks) {
+            free_chunks(b->chunks->next);
+            b->chunks->next = NULL;
+        }
+        atomic_store_explicit(&b->count, 0, memory_order_relaxed);
+        b->dropped = 0;
+        name_buffer(b);
+        atomic_store_explicit(&b->gen, gen, memory_order_release);
+    }
+
+    int n = atomic_load_explicit(&b->count, memory_order_relaxed);
+    if (n == TRACE_EVENTS) {
+        b->dropped++;
+        return;
+    }
+    int i = n % TRACE_CHUNK;
+    if (i == 0) {
+        trace_chunk_t *c = n ? b->cur->next : b->chunks;
+        if (!c && !(c = new_chunk())) {
+            b->dropped++;
+            return;
+        }
+        // Linked before count covers it, so trace_stop finds it
+        if (n) b->cur->next = c;
+        else b->chunks = c;
+        b->cur = c;
+    }
+    b->cur->events[i] = (trace_event_t){ .ts = metrics_now_ns(), .name = name, .phase = phase };
+    atomic_store_explicit(&b->count, n + 1, memory_order_release);
+}
+
+void trace_thread(int session, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(my_name, sizeof(my_name), format, args);
+    va_end(args);
+    my_session = session;
+    if (my_buffer && atomic_load(&my_buffer->gen) == atomic_load(&generation)) name_buffer(my_buffer);
+}
+
+void trace_start() {
+    start_ns = metrics_now_ns();
+    atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+    atomic_store(&trace_on, 1);
+}
+
+// Server threads are process 1, session n is process n + 2
+static int trace_pid(int session) {
+    return session < 0 ? 1 : session + 2;
+}
+
+long trace_stop(const char *path) {
+    atomic_store(&trace_on, 0);
+    unsigned gen = atomic_load(&generation);
+
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+
+    long events = 0, dropped = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"servidor\"}}");
+    for (trace_buffer_t *b = atomic_load(&buffers); b; b = b->next) {
+        if (atomic_load_explicit(&b->gen, memory_order_acquire) != gen) continue;
+        int n = atomic_load_explicit(&b->count, memory_order_acquire);
+        int pid = trace_pid(b->session);
+
+        if (b->session >= 0) {
+            fprintf(f, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"sessão %d\"}}",
+                    pid, b->session);
+        }
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, b->id, b->name);
+        trace_chunk_t *c = b->chunks;
+        for (int i = 0; i < n; i++) {
+            if (i > 0 && i % TRACE_CHUNK == 0) c = c->next;
+            trace_event_t *e = &c->events[i % TRACE_CHUNK];
+            if (e->ts < start_ns) continue;
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    e->name, e->phase, (e->ts - start_ns) / 1e3, pid, b->id);
+        }
+        events += n;
+        dropped += b->dropped;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    // The buffers of exited threads keep their header only. Claimed first, so a new
+    // thread can not take one while its chunks are freed
+    for (trace_buffer_t *b = atomic_load(&buffers); b; b = b->next) {
+        int expected = 0;
+        if (!atomic_compare_exchange_strong(&b->in_use, &expected, 1)) continue;
+        free_chunks(b->chunks);
+        b->chunks = NULL;
+        atomic_store(&b->count, 0);
+        atomic_store_explicit(&b->in_use, 0, memory_order_release);
+    }
+
+    if (dropped) fprintf(stderr, "Trace: %ld eventos perdidos (buffers cheios)\n", dropped);
+    return events;
+}
@@ -2,12 +2,16 @@
 #define API_H
 
 typedef struct {
-  int width;
+  int width; // of data: the whole board, or the window the server cut for the viewport
   int height;
   int tempo;
   int victory;
   int game_over;
   int accumulated_points;
+  int offset_x; // position of data on the board
+  int offset_y;
+  int board_width; // of the whole board
+  int board_height;
   char* data;
 } Board;
 
@@ -17,6 +21,10 @@ int pacman_connect(char const *req_pipe_path, char const *notif_pipe_path, char
 // Sends a command to the server
 void pacman_play(char command);
 
+// Tells the server how many map cells the client can show (0 = unlimited): boards that
+// don't fit come as a window around the pacman
+void pacman_viewport(int cols, int rows);
+
 /// @return 0 if the disconnection was successful, 1 otherwise.
 int pacman_disconnect();
 
@@ -19,6 +19,9 @@ int terminal_init();
 
 void draw_board_client(Board board);
 
+/*Map cells that fit on the screen between the title and the points line*/
+void get_viewport(int *cols, int *rows);
+
 /*Draw the board on the screen*/
 void draw_board(board_t* board, int mode);
 
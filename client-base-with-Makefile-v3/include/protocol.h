@@ -8,6 +8,8 @@ enum {
   OP_CODE_DISCONNECT = 2,
   OP_CODE_PLAY = 3,
   OP_CODE_BOARD = 4,
+  OP_CODE_VIEWPORT = 5, // client: int32 cols, rows of map it can show (0 = all)
+  OP_CODE_BOARD_VIEW = 6, // a board frame cut to the client's viewport
 };
 
 #endif
\ No newline at end of file
@@ -78,13 +78,22 @@ void pacman_play(char command) {
     write(req_fd, buf, 2);
 }
 
+// Send the size of the map area to the server
+void pacman_viewport(int cols, int rows) {
+    unsigned char buf[1 + 2 * sizeof(int32_t)];
+    int32_t size[2] = {(int32_t)cols, (int32_t)rows};
+    buf[0] = OP_CODE_VIEWPORT;
+    memcpy(buf + 1, size, sizeof(size));
+    write(req_fd, buf, sizeof(buf));
+}
+
 // Receive a board update from the server
 Board receive_board_update() {
     Board b = {0};
     unsigned char header[25];
     
     if (!read_exact(notif_fd, header, 25)) return b;
-    if (header[0] != OP_CODE_BOARD) return b;
+    if (header[0] != OP_CODE_BOARD && header[0] != OP_CODE_BOARD_VIEW) return b;
 
     int32_t values[6];
     memcpy(values, header + 1, 24);
@@ -95,6 +104,18 @@ Board receive_board_update() {
     b.victory = (int)values[3];
     b.game_over = (int)values[4];
     b.accumulated_points = (int)values[5];
+    b.board_width = b.width;
+    b.board_height = b.height;
+
+    if (header[0] == OP_CODE_BOARD_VIEW) {
+        // Window of a board bigger than the viewport: where it is and the board's size
+        int32_t view[4];
+        if (!read_exact(notif_fd, view, sizeof(view))) return b;
+        b.offset_x = (int)view[0];
+        b.offset_y = (int)view[1];
+        b.board_width = (int)view[2];
+        b.board_height = (int)view[3];
+    }
 
     int map_size = b.width * b.height;
     if (map_size > 0) {
@@ -56,6 +56,11 @@ int main(int argc, char *argv[]) {
 
     terminal_init();
 
+    // The server cuts boards bigger than the screen to a window around the pacman
+    int view_cols, view_rows;
+    get_viewport(&view_cols, &view_rows);
+    pacman_viewport(view_cols, view_rows);
+
     pthread_t r_tid;
     pthread_create(&r_tid, NULL, receiver_thread, NULL);
 
@@ -77,6 +82,14 @@ int main(int argc, char *argv[]) {
 
         if (cmd == 'Q') break;
         if (cmd != '\0') pacman_play(cmd);
+
+        int cols, rows;
+        get_viewport(&cols, &rows);
+        if (cols != view_cols || rows != view_rows) {
+            view_cols = cols;
+            view_rows = rows;
+            pacman_viewport(cols, rows);
+        }
     }
 
     pacman_disconnect();
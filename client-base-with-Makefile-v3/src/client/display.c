@@ -2,6 +2,7 @@
 #include "api.h"
 #include "display.h"
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <ncurses.h>
 
@@ -47,48 +48,103 @@ int terminal_init() {
 }
 
 
+#define BOARD_START_ROW 3 // below the title and the help line
+#define BOARD_FOOTER_ROWS 2 // blank line and points
+
+void get_viewport(int *cols, int *rows) {
+    *cols = COLS;
+    *rows = LINES - BOARD_START_ROW - BOARD_FOOTER_ROWS;
+    if (*rows < 1) *rows = 1;
+}
+
+// The frame on the screen: the glyph drawn in each map cell, to repaint only what changed
+static chtype *shown;
+static chtype *row_glyphs;
+static int shown_cols, shown_rows;
+static int shown_lines, shown_width; // LINES and COLS when it was drawn
+
+// The glyph a map cell is drawn with, colour and attributes included
+static chtype cell_glyph(char ch) {
+    switch (ch) {
+        case '#': case 'W': return '#' | COLOR_PAIR(3);
+        case 'C': case 'P': return 'C' | COLOR_PAIR(1) | A_BOLD;
+        case 'M': return 'M' | COLOR_PAIR(2) | A_BOLD; // Fantasma Normal
+        case 'm': return 'M' | COLOR_PAIR(2) | A_BOLD | A_DIM; // Fantasma Carregado
+        case '.': return '.' | COLOR_PAIR(4);
+        case '@': return '@' | COLOR_PAIR(6);
+        default: return (unsigned char)ch;
+    }
+}
+
+// Forgets the frame on the screen when the map window or the terminal changed size,
+// the next one is drawn whole. Returns -1 without memory for it
+static int reset_shown(int cols, int rows) {
+    if (shown && cols == shown_cols && rows == shown_rows && LINES == shown_lines && COLS == shown_width) return 0;
+
+    free(shown);
+    free(row_glyphs);
+    shown = calloc((size_t)cols * rows, sizeof(chtype)); // 0 matches no glyph
+    row_glyphs = malloc((size_t)cols * sizeof(chtype));
+    if (!shown || !row_glyphs) {
+        free(shown);
+        free(row_glyphs);
+        shown = row_glyphs = NULL;
+        return -1;
+    }
+    shown_cols = cols;
+    shown_rows = rows;
+    shown_lines = LINES;
+    shown_width = COLS;
+    erase(); // not clear(): that would make the next refresh repaint the whole terminal
+    return 0;
+}
+
+// Writes each run of cells whose glyph changed with a single call
+static void draw_row(int screen_row, const char *cells, int cols, chtype *prev) {
+    for (int x = 0; x < cols; x++) row_glyphs[x] = cell_glyph(cells[x]);
+
+    int x = 0;
+    while (x < cols) {
+        if (row_glyphs[x] == prev[x]) { x++; continue; }
+        int run = x;
+        while (x < cols && row_glyphs[x] != prev[x]) x++;
+        mvaddchnstr(screen_row, run, row_glyphs + run, x - run);
+    }
+    memcpy(prev, row_glyphs, (size_t)cols * sizeof(chtype));
+}
+
 void draw_board_client(Board board) {
-    clear();
+    // A frame sent before the server knew the viewport may not fit yet
+    int start_row = BOARD_START_ROW;
+    int cols, rows;
+    get_viewport(&cols, &rows);
+    if (cols > board.width) cols = board.width;
+    if (rows > board.height) rows = board.height;
+    if (reset_shown(cols, rows) != 0) return;
+
     attron(COLOR_PAIR(5));
     mvprintw(0, 0, "=== PACMAN GAME ===");
     if (board.game_over) mvprintw(1, 0, " GAME OVER ");
     else if (board.victory) mvprintw(1, 0, " VICTORY ");
     else mvprintw(1, 0, "Use W/A/S/D to move | Q to quit");
     attroff(COLOR_PAIR(5));
+    clrtoeol();
 
-    int start_row = 3;
-    for (int y = 0; y < board.height; y++) {
-        for (int x = 0; x < board.width; x++) {
-            int idx = y * board.width + x;
-            char ch = board.data[idx];
-            move(start_row + y, x);
-            
-            switch (ch) {
-                case '#': case 'W':
-                    attron(COLOR_PAIR(3)); addch('#'); attroff(COLOR_PAIR(3));
-                    break;
-                case 'C': case 'P':
-                    attron(COLOR_PAIR(1)|A_BOLD); addch('C'); attroff(COLOR_PAIR(1)|A_BOLD);
-                    break;
-                case 'M': // Fantasma Normal
-                    attron(COLOR_PAIR(2)|A_BOLD); addch('M'); attroff(COLOR_PAIR(2)|A_BOLD);
-                    break;
-                case 'm': // Fantasma Carregado (Recebido do servidor modificado)
-                    attron(COLOR_PAIR(2)|A_BOLD|A_DIM); addch('M'); attroff(COLOR_PAIR(2)|A_BOLD|A_DIM);
-                    break;
-                case '.':
-                    attron(COLOR_PAIR(4)); addch('.'); attroff(COLOR_PAIR(4));
-                    break;
-                case '@':
-                    attron(COLOR_PAIR(6)); addch('@'); attroff(COLOR_PAIR(6));
-                    break;
-                default:
-                    addch(ch);
-            }
-        }
+    for (int y = 0; y < rows; y++) {
+        draw_row(start_row + y, board.data + y * board.width, cols, shown + y * cols);
     }
-    mvprintw(start_row + board.height + 1, 0, "Points: %d", board.accumulated_points);
-    refresh();
+    if (board.width < board.board_width || board.height < board.board_height) {
+        mvprintw(start_row + rows + 1, 0, "Points: %d | View %d,%d of %dx%d", board.accumulated_points,
+                 board.offset_x, board.offset_y, board.board_width, board.board_height);
+    }
+    else {
+        mvprintw(start_row + rows + 1, 0, "Points: %d", board.accumulated_points);
+    }
+    clrtoeol();
+
+    // Only the cells that differ from the terminal are written out
+    wnoutrefresh(stdscr);
+    doupdate();
 }
 
 void refresh_screen() { 
@@ -97,10 +153,14 @@ void refresh_screen() {
 
 char get_input() { 
     int ch = getch(); 
-    return (ch == ERR) ? '\0' : toupper((char)ch); 
+    // KEY_RESIZE: LINES and COLS changed, the caller checks get_viewport
+    return (ch == ERR || ch == KEY_RESIZE) ? '\0' : toupper((char)ch); 
 }
 
 void terminal_cleanup() { 
+    free(shown);
+    free(row_glyphs);
+    shown = row_glyphs = NULL;
     clear();
     refresh();
     endwin();